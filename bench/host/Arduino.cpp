@@ -0,0 +1,32 @@
+#include <chrono>
+#include <stdio.h>
+
+#include "Arduino.h"
+
+HostSerial Serial;
+
+static const std::chrono::steady_clock::time_point started =
+    std::chrono::steady_clock::now();
+
+unsigned long millis() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - started
+    ).count();
+}
+
+void delay(unsigned long ms) {
+    unsigned long start = millis();
+    while(millis() - start < ms) {}
+}
+
+size_t Print::print(long value) {
+    char buffer[24];
+    snprintf(buffer, sizeof(buffer), "%ld", value);
+    return write(buffer);
+}
+
+size_t Print::print(unsigned long value) {
+    char buffer[24];
+    snprintf(buffer, sizeof(buffer), "%lu", value);
+    return write(buffer);
+}
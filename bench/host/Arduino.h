@@ -0,0 +1,73 @@
+#pragma once
+
+// Just enough of the Arduino core for the sources in `main/` that the
+// host benchmarks compile (SerialCommand, MultiSerial) to build with a
+// regular C++ compiler.  This is not a general-purpose replacement.
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+unsigned long millis();
+void delay(unsigned long ms);
+
+class Print
+{
+    public:
+        virtual ~Print() {}
+
+        virtual size_t write(uint8_t) = 0;
+        virtual size_t write(const uint8_t *buffer, size_t size) {
+            size_t n = 0;
+            while(size--) {
+                n += write(*buffer++);
+            }
+            return n;
+        }
+        size_t write(const char *str) {
+            return write((const uint8_t *) str, strlen(str));
+        }
+
+        size_t print(const char *str) { return write(str); }
+        size_t print(char c) { return write((uint8_t) c); }
+        size_t print(int value) { return print((long) value); }
+        size_t print(unsigned int value) { return print((unsigned long) value); }
+        size_t print(long value);
+        size_t print(unsigned long value);
+
+        size_t println() { return write("\r\n"); }
+        template<typename T>
+        size_t println(T value) {
+            size_t n = print(value);
+            return n + println();
+        }
+};
+
+class Stream : public Print
+{
+    public:
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int peek() = 0;
+        virtual void flush() = 0;
+};
+
+// Stands in for UART0; output is discarded.
+class HostSerial : public Stream
+{
+    public:
+        int available() { return 0; }
+        int read() { return -1; }
+        int peek() { return -1; }
+        void flush() {}
+        size_t write(uint8_t) { return 1; }
+        size_t write(const uint8_t *, size_t size) { return size; }
+        using Print::write;
+};
+
+extern HostSerial Serial;
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+
+#include "Arduino.h"
+
+// In-memory Stream used in place of SerialBT/UCSerial on the host.
+// Bytes queued with `feed` are returned by `read`; bytes written are
+// appended to `written` unless `record` is false, in which case they
+// are only counted.
+class MemoryStream : public Stream
+{
+    public:
+        void feed(const uint8_t *data, size_t size) {
+            if(inputPos == input.size()) {
+                input.clear();
+                inputPos = 0;
+            }
+            input.insert(input.end(), data, data + size);
+        }
+        void feed(const char *data) {
+            feed((const uint8_t *) data, strlen(data));
+        }
+
+        int available() {
+            return input.size() - inputPos;
+        }
+        int read() {
+            if(inputPos == input.size()) {
+                return -1;
+            }
+            return input[inputPos++];
+        }
+        int peek() {
+            if(inputPos == input.size()) {
+                return -1;
+            }
+            return input[inputPos];
+        }
+        void flush() {}
+
+        size_t write(uint8_t value) {
+            writtenCount++;
+            if(record) {
+                written.push_back(value);
+            }
+            return 1;
+        }
+        size_t write(const uint8_t *buffer, size_t size) {
+            writtenCount += size;
+            if(record) {
+                written.insert(written.end(), buffer, buffer + size);
+            }
+            return size;
+        }
+        using Print::write;
+
+        void clear() {
+            input.clear();
+            inputPos = 0;
+            written.clear();
+            writtenCount = 0;
+        }
+
+        std::vector<uint8_t> written;
+        size_t writtenCount = 0;
+        bool record = true;
+
+    private:
+        std::vector<uint8_t> input;
+        size_t inputPos = 0;
+};
@@ -0,0 +1,598 @@
+// Host simulation of the bridge's main loop against a simulated clock.
+//
+// Each scenario replays traffic from the microcontroller's UART through
+// BridgeCore and reports, as JSON on stdout, how long each message
+// waited before being written to bluetooth or how many bytes it took
+// to send.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "Arduino.h"
+#include "memorystream.h"
+
+#include "SerialCommand.h"
+#include "multiserial.h"
+#include "bridgeconfig.h"
+#include "sessions.h"
+#include "sequencer.h"
+
+// One byte at 230400 baud, 8E1
+#define SIM_UART_BYTE_US 48
+// Time taken by one pass through loop()
+#define SIM_LOOP_US 20
+// Quiet time between a request and the next response
+#define SIM_MESSAGE_GAP_US 100000
+#define SIM_MESSAGES 50
+// Matches UCSerial.setRxBufferSize() in main.cpp
+#define SIM_UART_RX_BUFFER 1024
+// Bytes sent by the microcontroller as it boots
+#define SIM_BOOT_BYTES 4096
+
+static unsigned long simMicros = 0;
+
+// Bluetooth stand-in recording the simulated time at which each byte
+// was written.
+class TimedSink : public Stream
+{
+    public:
+        int available() { return 0; }
+        int read() { return -1; }
+        int peek() { return -1; }
+        void flush() {}
+        size_t write(uint8_t) {
+            writeTimes.push_back(simMicros);
+            return 1;
+        }
+        size_t write(const uint8_t *, size_t size) {
+            writeTimes.insert(writeTimes.end(), size, simMicros);
+            return size;
+        }
+        using Print::write;
+
+        std::vector<unsigned long> writeTimes;
+};
+
+typedef ConfiguredBridge<TimedSink, MemoryStream> SimBridge;
+
+struct Arrival {
+    unsigned long time;
+    uint8_t value;
+};
+
+static bool firstResult = true;
+
+static void report(
+    const char *name,
+    Framing framing,
+    const std::vector<double>& latencies
+) {
+    double total = 0;
+    double worst = 0;
+    for(size_t i = 0; i < latencies.size(); i++) {
+        total += latencies[i];
+        if(latencies[i] > worst) {
+            worst = latencies[i];
+        }
+    }
+
+    printf(
+        "%s\n  {\"name\": \"%s\", \"framing\": \"%s\", \"messages\": %zu, "
+        "\"latency_ms_mean\": %.3f, \"latency_ms_max\": %.3f}",
+        firstResult ? "" : ",",
+        name,
+        framingName(framing),
+        latencies.size(),
+        latencies.empty() ? 0 : total / latencies.size(),
+        worst
+    );
+    firstResult = false;
+}
+
+// Sends `message` from the microcontroller SIM_MESSAGES times, leaving
+// SIM_MESSAGE_GAP_US between each as if waiting for the next request,
+// and measures the time between each message's last byte arriving at
+// the UART and it being written to bluetooth.
+static void simulateFraming(
+    const char *name,
+    Framing framing,
+    const std::vector<uint8_t>& message
+) {
+    TimedSink upstream;
+    MemoryStream downstream;
+    SimBridge bridge(upstream, downstream);
+    bridge.setConnected(true);
+    bridge.setFraming(framing);
+
+    std::vector<Arrival> arrivals;
+    std::vector<size_t> messageEnds;
+    unsigned long time = SIM_MESSAGE_GAP_US;
+    for(int i = 0; i < SIM_MESSAGES; i++) {
+        for(size_t j = 0; j < message.size(); j++) {
+            Arrival arrival = {time, message[j]};
+            arrivals.push_back(arrival);
+            time += SIM_UART_BYTE_US;
+        }
+        messageEnds.push_back(arrivals.size() - 1);
+        time += SIM_MESSAGE_GAP_US;
+    }
+
+    size_t next = 0;
+    for(simMicros = 0; simMicros < time; simMicros += SIM_LOOP_US) {
+        if(next < arrivals.size() && arrivals[next].time <= simMicros) {
+            bridge.fromDownstream(arrivals[next++].value, simMicros / 1000);
+        } else {
+            bridge.idle(simMicros / 1000);
+        }
+    }
+
+    std::vector<double> latencies;
+    for(size_t i = 0; i < messageEnds.size(); i++) {
+        size_t end = messageEnds[i];
+        if(end < upstream.writeTimes.size()) {
+            latencies.push_back(
+                (upstream.writeTimes[end] - arrivals[end].time) / 1000.0
+            );
+        }
+    }
+    report(name, framing, latencies);
+}
+
+static std::vector<uint8_t> slipFrame() {
+    std::vector<uint8_t> frame;
+    frame.push_back(SLIP_END);
+    for(uint8_t i = 0; i < 22; i++) {
+        frame.push_back(i * 3);
+    }
+    frame.push_back(SLIP_END);
+    return frame;
+}
+
+static std::vector<uint8_t> cobsFrame() {
+    std::vector<uint8_t> frame;
+    frame.push_back(23);
+    for(uint8_t i = 1; i < 23; i++) {
+        frame.push_back(i);
+    }
+    frame.push_back(COBS_DELIMITER);
+    return frame;
+}
+
+static std::vector<uint8_t> lengthFrame(uint8_t headerSize) {
+    std::vector<uint8_t> frame;
+    if(headerSize == 2) {
+        frame.push_back(0);
+    }
+    frame.push_back(20);
+    for(uint8_t i = 0; i < 20; i++) {
+        frame.push_back('\n' + i);
+    }
+    return frame;
+}
+
+static void simulateFramings() {
+    const char *text = "OK\n";
+    std::vector<uint8_t> line(text, text + strlen(text));
+    std::vector<uint8_t> ack(1, STM32_ACK);
+    std::vector<uint8_t> slip = slipFrame();
+    std::vector<uint8_t> cobs = cobsFrame();
+    std::vector<uint8_t> length8 = lengthFrame(1);
+    std::vector<uint8_t> length16 = lengthFrame(2);
+
+    simulateFraming("framing/line", FRAMING_LINE, line);
+
+    // Each binary protocol with the default line framing, then with
+    // its own framing.
+    simulateFraming("framing/stm32_ack", FRAMING_LINE, ack);
+    simulateFraming("framing/stm32_ack", FRAMING_STM32, ack);
+    simulateFraming("framing/slip", FRAMING_LINE, slip);
+    simulateFraming("framing/slip", FRAMING_SLIP, slip);
+    simulateFraming("framing/cobs", FRAMING_LINE, cobs);
+    simulateFraming("framing/cobs", FRAMING_COBS, cobs);
+    simulateFraming("framing/len8", FRAMING_LINE, length8);
+    simulateFraming("framing/len8", FRAMING_LENGTH8, length8);
+    simulateFraming("framing/len16", FRAMING_LINE, length16);
+    simulateFraming("framing/len16", FRAMING_LENGTH16, length16);
+}
+
+enum CompressionInput {
+    // Log lines with varying readings
+    INPUT_LOG_LINES,
+    // A single repeated line
+    INPUT_REPEATED_LINE,
+    // Log lines with a burst of random binary after every 100
+    INPUT_LOG_AND_BINARY,
+};
+
+// Sends 2000 lines of log output with compression enabled and reports
+// how many bytes crossed bluetooth for them.
+static void simulateCompression(const char *name, CompressionInput kind) {
+    TimedSink upstream;
+    MemoryStream downstream;
+    SimBridge bridge(upstream, downstream);
+    bridge.setConnected(true);
+    bridge.setCompression(true, 0);
+    size_t start = upstream.writeTimes.size();
+
+    srand(1);
+    char line[96];
+    for(int i = 0; i < 2000; i++) {
+        int length;
+        if(kind == INPUT_REPEATED_LINE) {
+            length = snprintf(line, sizeof(line), "[DEBUG] tick\n");
+        } else {
+            length = snprintf(
+                line, sizeof(line),
+                "[INFO] %06d adc: ch0=%04d ch1=%04d vbat=3.%02dV\n",
+                i, rand() % 4096, rand() % 4096, rand() % 100
+            );
+        }
+        for(int j = 0; j < length; j++) {
+            bridge.fromDownstream(line[j], 0);
+        }
+        if(kind == INPUT_LOG_AND_BINARY && i % 100 == 99) {
+            for(int j = 0; j < 4096; j++) {
+                bridge.fromDownstream(rand() & 0xff, 0);
+            }
+        }
+    }
+    bridge.flush(0);
+
+    uint32_t input = bridge.getCompressionInput();
+    uint32_t output = upstream.writeTimes.size() - start;
+    printf(
+        "%s\n  {\"name\": \"%s\", \"input_bytes\": %u, "
+        "\"output_bytes\": %u, \"ratio\": %.3f}",
+        firstResult ? "" : ",",
+        name,
+        input,
+        output,
+        (double) output / input
+    );
+    firstResult = false;
+}
+
+// Sends 20 seconds of ESP-IDF style log output, mostly debug lines,
+// through the line filter rules set up by `configure` and reports how
+// many bytes crossed bluetooth and how many lines were dropped.
+static void simulateFilter(const char *name, void (*configure)(SimBridge&)) {
+    TimedSink upstream;
+    MemoryStream downstream;
+    SimBridge bridge(upstream, downstream);
+    bridge.setConnected(true);
+    configure(bridge);
+
+    srand(1);
+    char line[96];
+    uint32_t input = 0;
+    for(int i = 0; i < 2000; i++) {
+        unsigned long now = i * 10;
+        int kind = rand() % 20;
+        int length;
+        if(kind < 14) {
+            length = snprintf(
+                line, sizeof(line), "D (%lu) wifi: rssi=-%d\n",
+                now, 40 + rand() % 50
+            );
+        } else if(kind < 19) {
+            length = snprintf(
+                line, sizeof(line), "I (%lu) adc: ch0=%04d vbat=3.%02dV\n",
+                now, rand() % 4096, rand() % 100
+            );
+        } else {
+            length = snprintf(
+                line, sizeof(line), "E (%lu) i2c: timeout\n", now
+            );
+        }
+        for(int j = 0; j < length; j++) {
+            bridge.fromDownstream(line[j], now);
+        }
+        input += length;
+    }
+
+    const LineFilter& filter = bridge.getFilter();
+    printf(
+        "%s\n  {\"name\": \"%s\", \"input_bytes\": %u, "
+        "\"output_bytes\": %u, \"lines\": 2000, \"dropped_lines\": %u}",
+        firstResult ? "" : ",",
+        name,
+        input,
+        (unsigned) upstream.writeTimes.size(),
+        filter.getDroppedLines()
+    );
+    firstResult = false;
+}
+
+static void noFilter(SimBridge&) {}
+
+static void excludeDebug(SimBridge& bridge) {
+    bridge.addFilterRule(FILTER_EXCLUDE, FILTER_LEVEL, "DV");
+}
+
+// Errors always, info at up to 2 lines per second, nothing else
+static void errorsAndSampledInfo(SimBridge& bridge) {
+    bridge.addFilterRule(FILTER_INCLUDE, FILTER_LEVEL, "EW");
+    bridge.addFilterRule(FILTER_INCLUDE, FILTER_LEVEL, "I", 2, 5);
+}
+
+// A microcontroller that starts printing SIM_BOOT_BYTES of boot output
+// as soon as its nRST is released, feeding a UART receive buffer of
+// SIM_UART_RX_BUFFER bytes that overflows if loop() doesn't drain it.
+static struct {
+    bool inReset;
+    bool booting;
+    unsigned long nextByte;
+    size_t sent;
+    size_t dropped;
+    std::vector<uint8_t> rxBuffer;
+    size_t rxPosition;
+} uc;
+
+static void simNrstLow() {
+    uc.inReset = true;
+}
+
+static void simNrstRelease() {
+    if(uc.inReset) {
+        uc.booting = true;
+        uc.nextByte = simMicros;
+    }
+    uc.inReset = false;
+}
+
+static void simBoot0() {}
+
+static void advanceUart() {
+    while(uc.booting && uc.sent < SIM_BOOT_BYTES && uc.nextByte <= simMicros) {
+        if(uc.rxBuffer.size() - uc.rxPosition < SIM_UART_RX_BUFFER) {
+            uc.rxBuffer.push_back(' ' + uc.sent % 64);
+        } else {
+            uc.dropped++;
+        }
+        uc.sent++;
+        uc.nextByte += SIM_UART_BYTE_US;
+    }
+}
+
+// Advances the clock without running loop(), as delay() would.
+static void simDelay(unsigned long ms) {
+    unsigned long until = simMicros + ms * 1000;
+    for(; simMicros < until; simMicros += SIM_LOOP_US) {
+        advanceUart();
+    }
+}
+
+static void simSequenceDone() {}
+
+typedef UcSequences<
+    simNrstLow, simNrstRelease, simBoot0, simBoot0, simSequenceDone
+> SimSequences;
+
+// Runs `flash_uc` either by blocking in delay() between steps (as it
+// did originally) or through a Sequencer polled from loop(), and
+// reports how much of the microcontroller's boot output reached
+// bluetooth.
+static void simulateFlash(const char *name, bool blocking) {
+    TimedSink upstream;
+    MemoryStream downstream;
+    SimBridge bridge(upstream, downstream);
+    Sequencer sequencer;
+    bridge.setConnected(true);
+
+    uc.inReset = false;
+    uc.booting = false;
+    uc.sent = 0;
+    uc.dropped = 0;
+    uc.rxBuffer.clear();
+    uc.rxPosition = 0;
+
+    simMicros = 0;
+    if(blocking) {
+        for(size_t i = 0; i < SimSequences::flashLength; i++) {
+            SimSequences::flash[i].action();
+            simDelay(SimSequences::flash[i].wait);
+        }
+    } else {
+        sequencer.start(
+            SimSequences::flash, SimSequences::flashLength, simMicros / 1000
+        );
+    }
+
+    unsigned long end = simMicros + 2000000 + SIM_BOOT_BYTES * SIM_UART_BYTE_US;
+    for(; simMicros < end; simMicros += SIM_LOOP_US) {
+        advanceUart();
+        sequencer.poll(simMicros / 1000);
+        if(uc.rxPosition < uc.rxBuffer.size()) {
+            bridge.fromDownstream(uc.rxBuffer[uc.rxPosition++], simMicros / 1000);
+        } else {
+            bridge.idle(simMicros / 1000);
+        }
+    }
+    bridge.flush(simMicros / 1000);
+
+    printf(
+        "%s\n  {\"name\": \"%s\", \"boot_bytes\": %zu, "
+        "\"forwarded_bytes\": %zu, \"lost_bytes\": %zu}",
+        firstResult ? "" : ",",
+        name,
+        uc.sent,
+        upstream.writeTimes.size(),
+        uc.dropped
+    );
+    firstResult = false;
+}
+
+static unsigned long commandsRun = 0;
+static unsigned long commandsUnrecognized = 0;
+
+static void simCommand() {
+    commandsRun++;
+}
+
+static void simUnrecognized(const char *) {
+    commandsUnrecognized++;
+}
+
+// An interface over which `data` arrives one byte every
+// SIM_UART_BYTE_US, starting at `start` us.
+class TimedSource : public Stream
+{
+    public:
+        void send(const std::string& value, unsigned long at) {
+            data = value;
+            start = at;
+            position = 0;
+        }
+
+        int available() {
+            if(simMicros < start) {
+                return 0;
+            }
+            size_t arrived = (simMicros - start) / SIM_UART_BYTE_US + 1;
+            if(arrived > data.size()) {
+                arrived = data.size();
+            }
+            return arrived - position;
+        }
+        int read() {
+            if(!available()) {
+                return -1;
+            }
+            return (uint8_t) data[position++];
+        }
+        int peek() {
+            return available() ? (uint8_t) data[position] : -1;
+        }
+        void flush() {}
+        size_t write(uint8_t) { return 1; }
+        using Print::write;
+
+    private:
+        std::string data;
+        unsigned long start = 0;
+        size_t position = 0;
+};
+
+static bool simSessionEnabled(SerialCommand*) {
+    return true;
+}
+
+// Two interfaces (say, an operator on UART0 and the microcontroller
+// using BT_KEY) each send 100 commands over the same period, their
+// bytes arriving interleaved in time.  They are read either by a
+// single parser reading from a MultiSerial (as CmdSerial originally
+// was) or by one parser per interface polled by pollSessions() as
+// commandLoop() does.
+static void simulateSessions(const char *name, bool shared) {
+    TimedSource interfaces[2];
+    MultiSerial merged;
+    SerialCommand sharedCommands(&merged);
+    SerialCommand first(&interfaces[0]);
+    SerialCommand second(&interfaces[1]);
+    SerialCommand *sessions[] = {&first, &second};
+    SerialCommand *current = &first;
+    uint8_t next = 0;
+
+    std::string commands[2];
+    for(int j = 0; j < 100; j++) {
+        commands[0] += "framing line\n";
+        commands[1] += "monitor 1\n";
+    }
+    for(int i = 0; i < 2; i++) {
+        merged.addInterface(&interfaces[i]);
+        // Half a byte apart, so neither is always first
+        interfaces[i].send(commands[i], i * SIM_UART_BYTE_US / 2);
+    }
+    SerialCommand *parsers[] = {&sharedCommands, &first, &second};
+    for(int i = 0; i < 3; i++) {
+        parsers[i]->addCommand("monitor", simCommand);
+        parsers[i]->addCommand("framing", simCommand);
+        parsers[i]->setDefaultHandler(simUnrecognized);
+        parsers[i]->disableEcho();
+    }
+
+    commandsRun = 0;
+    commandsUnrecognized = 0;
+    unsigned long end = (commands[0].size() + 1) * SIM_UART_BYTE_US;
+    for(simMicros = 0; simMicros < end; simMicros += SIM_LOOP_US) {
+        if(shared) {
+            sharedCommands.readSerial();
+        } else {
+            pollSessions(sessions, 2, next, simSessionEnabled, current);
+        }
+    }
+
+    printf(
+        "%s\n  {\"name\": \"%s\", \"commands_sent\": 200, "
+        "\"commands_run\": %lu, \"commands_unrecognized\": %lu}",
+        firstResult ? "" : ",",
+        name,
+        commandsRun,
+        commandsUnrecognized
+    );
+    firstResult = false;
+}
+
+static bool simEscaped = true;
+
+static void simUnescape() {
+    simEscaped = false;
+}
+
+static bool simEscapedEnabled(SerialCommand*) {
+    return simEscaped;
+}
+
+// A bluetooth client sends `unescape` followed immediately by bytes
+// meant for the microcontroller, all arriving before the next poll.
+// Once the command has run, everything after it should be left
+// unread for the pass-through rather than fed to the parser.
+static void simulateUnescape(const char *name) {
+    const std::string passThrough("\x7f\x00\x11", 3);
+    TimedSource bluetooth;
+    SerialCommand commands(&bluetooth);
+    SerialCommand *sessions[] = {&commands};
+    SerialCommand *current = &commands;
+    uint8_t next = 0;
+
+    commands.addCommand("unescape", simUnescape);
+    commands.setDefaultHandler(simUnrecognized);
+    commands.disableEcho();
+
+    std::string data = "unescape\n" + passThrough;
+    bluetooth.send(data, 0);
+    simMicros = data.size() * SIM_UART_BYTE_US;
+    simEscaped = true;
+    pollSessions(sessions, 1, next, simEscapedEnabled, current);
+
+    printf(
+        "%s\n  {\"name\": \"%s\", \"passthrough_bytes_sent\": %zu, "
+        "\"passthrough_bytes_left\": %d}",
+        firstResult ? "" : ",",
+        name,
+        passThrough.size(),
+        bluetooth.available()
+    );
+    firstResult = false;
+}
+
+int main() {
+    printf("{\"simulations\": [");
+    simulateFramings();
+    simulateCompression("compression/log_lines", INPUT_LOG_LINES);
+    simulateCompression("compression/repeated_line", INPUT_REPEATED_LINE);
+    simulateCompression("compression/log_and_binary", INPUT_LOG_AND_BINARY);
+    simulateFilter("filter/none", noFilter);
+    simulateFilter("filter/exclude_debug", excludeDebug);
+    simulateFilter("filter/errors_and_sampled_info", errorsAndSampledInfo);
+    simulateFlash("flash_uc/blocking", true);
+    simulateFlash("flash_uc/sequenced", false);
+    simulateSessions("commands/shared_parser", true);
+    simulateSessions("commands/per_interface", false);
+    simulateUnescape("commands/unescape_then_passthrough");
+    printf("\n]}\n");
+    return 0;
+}
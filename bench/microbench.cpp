@@ -0,0 +1,314 @@
+// Host microbenchmarks for the per-byte primitives in `main/`.
+//
+// Results are written to stdout as a single JSON document; pass a
+// substring as the first argument to only run matching benchmarks.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "Arduino.h"
+#include "memorystream.h"
+
+#include "SerialCommand.h"
+#include "multiserial.h"
+#include "bridgeconfig.h"
+#include "lzstream.h"
+#include "libb64/cdecode.h"
+
+#include "microbench.h"
+
+typedef ConfiguredBridge<MemoryStream, MemoryStream> HostBridge;
+
+// Stream that always has another byte of `pattern` ready.
+class PatternStream : public Stream
+{
+    public:
+        PatternStream(const char *pattern)
+            : pattern(pattern), length(strlen(pattern)) {}
+
+        int available() { return 1; }
+        int read() {
+            uint8_t value = pattern[position++];
+            if(position == length) {
+                position = 0;
+            }
+            return value;
+        }
+        int peek() { return pattern[position]; }
+        void flush() {}
+        size_t write(uint8_t) { return 1; }
+        using Print::write;
+
+    private:
+        const char *pattern;
+        size_t length;
+        size_t position = 0;
+};
+
+static const char *LOG_LINE =
+    "[INFO] 001234 adc: ch0=1021 ch1=0344 ch2=2048 vbat=3.71V\n";
+
+static void noop() {}
+
+static std::string base64Encode(const std::vector<uint8_t>& data) {
+    static const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string output;
+
+    for(size_t i = 0; i < data.size(); i += 3) {
+        uint32_t group = data[i] << 16;
+        if(i + 1 < data.size()) group |= data[i + 1] << 8;
+        if(i + 2 < data.size()) group |= data[i + 2];
+
+        output += alphabet[(group >> 18) & 0x3f];
+        output += alphabet[(group >> 12) & 0x3f];
+        output += i + 1 < data.size() ? alphabet[(group >> 6) & 0x3f] : '=';
+        output += i + 2 < data.size() ? alphabet[group & 0x3f] : '=';
+    }
+    return output;
+}
+
+static void benchSerialCommand(Bench& bench, bool echo) {
+    MemoryStream output;
+    output.record = false;
+
+    SerialCommand commands(&output);
+    commands.addCommand("flash_esp32", noop);
+    commands.addCommand("flash_uc", noop);
+    commands.addCommand("reset_uc", noop);
+    commands.addCommand("connected", noop);
+    commands.addCommand("monitor", noop);
+    commands.addCommand("nrst", noop);
+    commands.addCommand("unescape", noop);
+    if(!echo) {
+        commands.disableEcho();
+    }
+
+    const char *line = "monitor 1\n";
+    size_t length = strlen(line);
+
+    bench.run(
+        echo ? "serialcommand/readChar/echo" : "serialcommand/readChar/noecho",
+        1,
+        [&](unsigned long iterations) {
+            size_t position = 0;
+            for(unsigned long i = 0; i < iterations; i++) {
+                commands.readChar(line[position++]);
+                if(position == length) {
+                    position = 0;
+                }
+            }
+        }
+    );
+}
+
+static void benchMultiSerial(Bench& bench, uint8_t interfaceCount) {
+    MemoryStream sinks[5];
+    PatternStream source(LOG_LINE);
+    MultiSerial writer;
+    MultiSerial reader;
+
+    for(uint8_t i = 0; i < interfaceCount; i++) {
+        sinks[i].record = false;
+        writer.addInterface(&sinks[i]);
+    }
+    // Only the last interface has data, so each read has to skip over
+    // all of the others.
+    for(uint8_t i = 0; i < interfaceCount - 1; i++) {
+        reader.addInterface(&sinks[i]);
+    }
+    reader.addInterface(&source);
+
+    char name[64];
+    snprintf(name, sizeof(name), "multiserial/write/%u", interfaceCount);
+    bench.run(name, 1, [&](unsigned long iterations) {
+        for(unsigned long i = 0; i < iterations; i++) {
+            writer.write((uint8_t) i);
+        }
+    });
+
+    snprintf(name, sizeof(name), "multiserial/read/%u", interfaceCount);
+    bench.run(name, 1, [&](unsigned long iterations) {
+        int sum = 0;
+        for(unsigned long i = 0; i < iterations; i++) {
+            sum += reader.read();
+        }
+        Bench::keep(sum);
+    });
+}
+
+static void benchBase64(Bench& bench) {
+    // Matches the default `--chunk-size` of programming/ota_flash.py
+    std::vector<uint8_t> chunk(700);
+    for(size_t i = 0; i < chunk.size(); i++) {
+        chunk[i] = (i * 131 + 17) & 0xff;
+    }
+    std::string line = base64Encode(chunk);
+    std::vector<char> decoded(line.size());
+
+    bench.run("libb64/decode_block/ota_line", line.size(), [&](unsigned long iterations) {
+        for(unsigned long i = 0; i < iterations; i++) {
+            base64_decodestate state;
+            base64_init_decodestate(&state);
+            Bench::keep(
+                base64_decode_block(line.c_str(), line.size(), &decoded[0], &state)
+            );
+        }
+    });
+}
+
+static void benchEscape(Bench& bench) {
+    MemoryStream upstream;
+    MemoryStream downstream;
+    HostBridge bridge(upstream, downstream);
+
+    bench.run("bridge/matchEscape", 1, [&](unsigned long iterations) {
+        int matched = 0;
+        size_t position = 0;
+        for(unsigned long i = 0; i < iterations; i++) {
+            matched += bridge.matchEscape(LOG_LINE[position++], i);
+            if(LOG_LINE[position] == '\0') {
+                position = 0;
+            }
+        }
+        Bench::keep(matched);
+    });
+}
+
+static void benchSendBuffer(Bench& bench) {
+    MemoryStream upstream;
+    MemoryStream downstream;
+    upstream.record = false;
+    HostBridge bridge(upstream, downstream);
+    bridge.setConnected(true);
+
+    size_t length = strlen(LOG_LINE);
+
+    bench.run("bridge/fromDownstream/lines", 1, [&](unsigned long iterations) {
+        size_t position = 0;
+        for(unsigned long i = 0; i < iterations; i++) {
+            bridge.fromDownstream(LOG_LINE[position++], 0);
+            if(position == length) {
+                position = 0;
+            }
+        }
+    });
+
+    // No newlines: every flush is caused by the buffer filling up
+    bench.run("bridge/fromDownstream/binary", 1, [&](unsigned long iterations) {
+        for(unsigned long i = 0; i < iterations; i++) {
+            bridge.fromDownstream(((i * 7) & 0x7f) | 0x80, 0);
+        }
+    });
+}
+
+static void benchCompression(Bench& bench) {
+    StreamCompressor compressor;
+    uint8_t output[MAX_SEND_BUFFER];
+    size_t length = strlen(LOG_LINE);
+
+    bench.run("lzstream/compress/log_line", length, [&](unsigned long iterations) {
+        for(unsigned long i = 0; i < iterations; i++) {
+            Bench::keep(compressor.compress(
+                (const uint8_t *) LOG_LINE, length, output, length - 1
+            ));
+        }
+    });
+
+    MemoryStream upstream;
+    MemoryStream downstream;
+    upstream.record = false;
+    HostBridge bridge(upstream, downstream);
+    bridge.setConnected(true);
+    bridge.setCompression(true, 0);
+
+    bench.run("bridge/fromDownstream/compressed", 1, [&](unsigned long iterations) {
+        size_t position = 0;
+        for(unsigned long i = 0; i < iterations; i++) {
+            bridge.fromDownstream(LOG_LINE[position++], 0);
+            if(position == length) {
+                position = 0;
+            }
+        }
+    });
+}
+
+// With every rule's pattern somewhere other than LOG_LINE, so that
+// each line is matched against all of them; the per-byte cost should
+// not depend on `rules`.
+static void benchFilter(Bench& bench, uint8_t rules) {
+    // 31 bytes between them, so all eight fit in the automaton
+    // (LINE_FILTER_PATTERN_BITS)
+    static const char* const PATTERNS[] = {
+        "beat", "DEBUG", "rssi", "tick", "gc:", "idle", "V (", "ping",
+    };
+    MemoryStream upstream;
+    MemoryStream downstream;
+    upstream.record = false;
+    HostBridge bridge(upstream, downstream);
+    bridge.setConnected(true);
+    for(uint8_t i = 0; i < rules; i++) {
+        if(!bridge.addFilterRule(FILTER_EXCLUDE, FILTER_CONTAINS, PATTERNS[i])) {
+            fprintf(stderr, "Filter rule rejected: %s\n", PATTERNS[i]);
+            exit(1);
+        }
+    }
+
+    size_t length = strlen(LOG_LINE);
+
+    char name[64];
+    snprintf(name, sizeof(name), "bridge/fromDownstream/filtered/%d_rules", rules);
+    bench.run(name, 1, [&](unsigned long iterations) {
+        size_t position = 0;
+        for(unsigned long i = 0; i < iterations; i++) {
+            bridge.fromDownstream(LOG_LINE[position++], 0);
+            if(position == length) {
+                position = 0;
+            }
+        }
+    });
+}
+
+static void benchFraming(Bench& bench, Framing framing) {
+    FrameDetector detector(framing);
+    size_t length = strlen(LOG_LINE);
+
+    char name[64];
+    snprintf(name, sizeof(name), "framing/boundary/%s", framingName(framing));
+    bench.run(name, 1, [&](unsigned long iterations) {
+        int boundaries = 0;
+        size_t position = 0;
+        for(unsigned long i = 0; i < iterations; i++) {
+            boundaries += detector.boundary(LOG_LINE[position++]);
+            if(position == length) {
+                position = 0;
+            }
+        }
+        Bench::keep(boundaries);
+    });
+}
+
+int main(int argc, char **argv) {
+    Bench bench(argc > 1 ? argv[1] : NULL);
+
+    benchSerialCommand(bench, true);
+    benchSerialCommand(bench, false);
+    for(uint8_t count = 1; count <= 5; count++) {
+        benchMultiSerial(bench, count);
+    }
+    benchBase64(bench);
+    benchEscape(bench);
+    benchSendBuffer(bench);
+    benchCompression(bench);
+    benchFilter(bench, 1);
+    benchFilter(bench, 8);
+    for(size_t framing = 0; framing < FRAMING_COUNT; framing++) {
+        benchFraming(bench, (Framing) framing);
+    }
+
+    bench.report(stdout);
+    return 0;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Minimal benchmark runner.  Each benchmark body is handed an iteration
+// count and must perform that many operations; the count is doubled
+// until one pass takes at least `minimumTime`, then the fastest of
+// `repetitions` passes is reported.
+class Bench
+{
+    public:
+        struct Result {
+            std::string name;
+            unsigned long iterations;
+            double nsPerOp;
+            double bytesPerSecond;
+        };
+
+        Bench(const char *filter) : filter(filter) {}
+
+        template<typename Body>
+        void run(const char *name, size_t bytesPerOp, Body body) {
+            if(filter && !strstr(name, filter)) {
+                return;
+            }
+
+            unsigned long iterations = 1;
+            while(elapsed(body, iterations) < minimumTime && iterations < (1UL << 30)) {
+                iterations *= 2;
+            }
+
+            double best = 0;
+            for(int i = 0; i < repetitions; i++) {
+                double ns = elapsed(body, iterations);
+                if(i == 0 || ns < best) {
+                    best = ns;
+                }
+            }
+
+            Result result;
+            result.name = name;
+            result.iterations = iterations;
+            result.nsPerOp = best / iterations;
+            result.bytesPerSecond = bytesPerOp * 1e9 / result.nsPerOp;
+            results.push_back(result);
+
+            fprintf(stderr, "%-40s %10.2f ns/op\n", name, result.nsPerOp);
+        }
+
+        void report(FILE *output) const {
+            fprintf(output, "{\"benchmarks\": [");
+            for(size_t i = 0; i < results.size(); i++) {
+                fprintf(
+                    output,
+                    "%s\n  {\"name\": \"%s\", \"iterations\": %lu, "
+                    "\"ns_per_op\": %.3f, \"bytes_per_second\": %.0f}",
+                    i ? "," : "",
+                    results[i].name.c_str(),
+                    results[i].iterations,
+                    results[i].nsPerOp,
+                    results[i].bytesPerSecond
+                );
+            }
+            fprintf(output, "\n]}\n");
+        }
+
+        // Prevents the compiler from discarding a computed value.
+        template<typename T>
+        static void keep(T value) {
+            static volatile T sink;
+            sink = value;
+            (void) sink;
+        }
+
+    private:
+        template<typename Body>
+        static double elapsed(Body& body, unsigned long iterations) {
+            std::chrono::steady_clock::time_point start =
+                std::chrono::steady_clock::now();
+            body(iterations);
+            return std::chrono::duration<double, std::nano>(
+                std::chrono::steady_clock::now() - start
+            ).count();
+        }
+
+        static constexpr double minimumTime = 50e6;
+        static const int repetitions = 5;
+
+        const char *filter;
+        std::vector<Result> results;
+};
@@ -83,6 +83,19 @@ void SerialCommand::disableEcho() {
   echoEnabled = false;
 }
 
+Stream* SerialCommand::getSerial() {
+  return serial;
+}
+
+/**
+ * Don't print a prompt after the command currently being run; for
+ * commands after which the stream no longer belongs to the command line.
+ * skipPrompt(false) cancels this.
+ */
+void SerialCommand::skipPrompt(bool skip) {
+  promptSkipped = skip;
+}
+
 void SerialCommand::prompt() {
   if(echoEnabled) {
     serial->println();
@@ -144,7 +157,11 @@ void SerialCommand::readChar(char inChar) {
       }
     }
     clearBuffer();
-    prompt();
+    if (promptSkipped) {
+      promptSkipped = false;
+    } else {
+      prompt();
+    }
   } else if(inChar == 0x8 && bufPos > 0) {
     if(echoEnabled) {
       serial->write(0x08);
@@ -36,7 +36,9 @@
 #define SERIALCOMMAND_PROMPT ">> "
 
 // Size of the input buffer in bytes (maximum length of one command plus arguments)
+#ifndef SERIALCOMMAND_BUFFER
 #define SERIALCOMMAND_BUFFER 1024
+#endif
 // Maximum length of a command excluding the terminating null
 #define SERIALCOMMAND_MAXCOMMANDLENGTH 25
 
@@ -59,6 +61,8 @@ class SerialCommand {
     char *next();         // Returns pointer to next token found in command buffer (for getting arguments to commands).
 
     void disableEcho();
+    Stream* getSerial();  // Stream that this instance reads from and replies to
+    void skipPrompt(bool skip = true);  // Skips the prompt after the command being run
 
   private:
     // Command/handler dictionary
@@ -73,6 +77,7 @@ class SerialCommand {
     void (*defaultHandler)(const char *);
 
     bool echoEnabled = true;
+    bool promptSkipped = false;
 
     char delim[2]; // null-terminated list of character to be used as delimeters for tokenizing (default " ")
     char term;     // Character that signals end of command (default '\n')
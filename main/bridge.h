@@ -0,0 +1,417 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "framing.h"
+#include "linefilter.h"
+#include "lzstream.h"
+
+// The forwarding core of the bridge.  Everything that happens per-byte
+// between the Bluetooth link (upstream) and the microcontroller's UART
+// (downstream) lives here so that it can be compiled against the
+// concrete stream classes -- the firmware instantiates it over
+// BluetoothSerial and HardwareSerial, while host builds (see `bench/`)
+// instantiate it over plain in-memory streams.
+//
+// Nothing in this file may depend on Arduino.h; time is passed in by
+// the caller (normally `millis()`).
+
+template<uint8_t... Bytes>
+struct EscapeSequence {
+    static constexpr uint8_t bytes[sizeof...(Bytes)] = {Bytes...};
+    static constexpr uint8_t length = sizeof...(Bytes);
+};
+
+template<uint8_t... Bytes>
+constexpr uint8_t EscapeSequence<Bytes...>::bytes[sizeof...(Bytes)];
+
+template<
+    typename Upstream,
+    typename Downstream,
+    size_t SendBufferSize,
+    size_t BacklogSize,
+    typename Escape,
+    unsigned long EscapeInterCharacterDelay,
+    unsigned long MaxSendWait
+>
+class BridgeCore
+{
+    static_assert(SendBufferSize > 0, "Send buffer must not be empty");
+    static_assert(BacklogSize > 0, "Backlog must not be empty");
+    static_assert(Escape::length > 0, "Escape sequence must not be empty");
+    static_assert(
+        SendBufferSize <= 255,
+        "Compressed frames store the send buffer length in one byte"
+    );
+
+    public:
+        static const size_t sendBufferSize = SendBufferSize;
+
+        BridgeCore(Upstream& upstream, Downstream& downstream)
+            : upstream(upstream), downstream(downstream) {}
+
+        // Called with each byte received from the microcontroller that
+        // should be forwarded over Bluetooth.  Bytes are collected in
+        // the send buffer and written out at the end of each message
+        // (see `setFraming`) or once the buffer is full.
+        inline void fromDownstream(uint8_t value, unsigned long now) {
+            // Every byte, even one the filter drops, is part of the
+            // framing.
+            bool boundary = framing.boundary(value);
+            bool kept = !filter.active() || filterLine(value, now);
+            atLineStart = value == '\n';
+            if(kept) {
+                sendBuffer[sendLength++] = value;
+            }
+            if(boundary || sendLength >= SendBufferSize) {
+                flush(now);
+            }
+        }
+
+        // Called with each byte received over Bluetooth while not
+        // escaped; forwards it to the microcontroller and returns true
+        // if it completed the escape sequence.
+        inline bool fromUpstream(uint8_t value, unsigned long now) {
+            downstream.Downstream::write(value);
+            return matchEscape(value, now);
+        }
+
+        // Returns true once the whole escape sequence has been seen
+        // with at least `EscapeInterCharacterDelay` ms between bytes.
+        inline bool matchEscape(uint8_t value, unsigned long now) {
+            if(
+                value == Escape::bytes[escapePos]
+                && now > (lastEscapeChar + EscapeInterCharacterDelay)
+            ) {
+                lastEscapeChar = now;
+                escapePos++;
+            } else {
+                escapePos = 0;
+            }
+            if(escapePos == Escape::length) {
+                escapePos = 0;
+                return true;
+            }
+            return false;
+        }
+
+        // Flushes anything that has been waiting longer than
+        // `MaxSendWait` ms; call whenever the downstream is idle.
+        inline void idle(unsigned long now) {
+            if(now - lastSend > MaxSendWait) {
+                flush(now);
+            }
+        }
+
+        void flush(unsigned long now) {
+            // A line still being matched when it has to be sent is
+            // decided on what has arrived so far.
+            if(
+                filter.active()
+                && filter.undecided()
+                && sendLength > lineStart
+            ) {
+                if(!filter.decide(now, sendLength - lineStart)) {
+                    sendLength = lineStart;
+                }
+            }
+            lineStart = 0;
+
+            if(connected && sendLength > 0) {
+                if(compressing) {
+                    writeCompressed();
+                } else {
+                    writeUpstream(sendBuffer, sendLength);
+                }
+            } else if(sendLength > 0 && !everConnected) {
+                keepBacklog();
+            }
+            sendLength = 0;
+            lastSend = now;
+        }
+
+        // Switches the upstream between raw bytes and compressed frames
+        // (see lzstream.h); anything already buffered is flushed first.
+        void setCompression(bool value, unsigned long now) {
+            if(value == compressing) {
+                return;
+            }
+            flush(now);
+            bool wasPaused = compressionPaused;
+            compressing = value;
+            compressionPaused = false;
+            windowInput = 0;
+            windowOutput = 0;
+            if(!connected) {
+                return;
+            }
+
+            if(compressing) {
+                startStream();
+            } else if(!wasPaused) {
+                endStream();
+            }
+        }
+
+        bool isCompressing() const {
+            return compressing;
+        }
+
+        // True while compression is enabled but blocks are being sent
+        // raw because they weren't compressing (see lzstream.h).
+        bool isCompressionPaused() const {
+            return compressionPaused;
+        }
+
+        // Bytes flushed while compression was enabled, and the bytes
+        // (including frame headers) actually sent for them.
+        uint32_t getCompressionInput() const {
+            return compressionInput;
+        }
+
+        uint32_t getCompressionOutput() const {
+            return compressionOutput;
+        }
+
+        // Output flushed before the first client connects (e.g. the
+        // microcontroller's boot messages) is kept, the most recent
+        // BacklogSize bytes of it, and sent as soon as one does; after
+        // that, output while no client is connected is discarded as
+        // usual.
+        void setConnected(bool value) {
+            connected = value;
+            if(connected) {
+                everConnected = true;
+                writeBacklog();
+            } else {
+                // A new client has to ask for compression again
+                compressing = false;
+                compressionPaused = false;
+            }
+        }
+
+        bool isConnected() const {
+            return connected;
+        }
+
+        // Bytes waiting for a client, and bytes that didn't fit
+        size_t getBacklog() const {
+            return backlogLength;
+        }
+
+        uint32_t getBacklogDropped() const {
+            return backlogDropped;
+        }
+
+        void setFraming(Framing value) {
+            framing.setFraming(value);
+        }
+
+        Framing getFraming() const {
+            return framing.getFraming();
+        }
+
+        size_t pending() const {
+            return sendLength;
+        }
+
+        // Adds a line filter rule; see linefilter.h.  Returns false if
+        // there is no room for it.
+        bool addFilterRule(
+            FilterAction action,
+            FilterMatch match,
+            const char* pattern,
+            uint16_t rate = 0,
+            uint16_t burst = 0
+        ) {
+            bool added = filter.addRule(action, match, pattern, rate, burst);
+            restartFilter();
+            return added;
+        }
+
+        void clearFilterRules() {
+            filter.clearRules();
+            restartFilter();
+        }
+
+        void resetFilterCounters() {
+            filter.resetCounters();
+        }
+
+        const LineFilter& getFilter() const {
+            return filter;
+        }
+
+    private:
+        // Feeds `value` to the line filter; returns false if it belongs
+        // to a line that is being dropped.  Bytes of an undecided line
+        // are held in the send buffer from `lineStart` onward.
+        // Rules take effect from the next line; any line already in
+        // progress is sent as-is rather than being matched from its
+        // middle.
+        void restartFilter() {
+            if(!atLineStart) {
+                filter.skipLine();
+            }
+            lineStart = sendLength;
+        }
+
+        inline bool filterLine(uint8_t value, unsigned long now) {
+            bool endOfLine = value == '\n';
+
+            if(filter.undecided()) {
+                filter.feed(value);
+                if(!endOfLine) {
+                    return true;
+                }
+                bool send = filter.decide(now, sendLength - lineStart + 1);
+                filter.endLine();
+                if(!send) {
+                    sendLength = lineStart;
+                    return false;
+                }
+                lineStart = sendLength + 1;
+                return true;
+            }
+
+            bool send = !filter.dropping();
+            if(!send) {
+                filter.countDropped(1);
+            }
+            if(endOfLine) {
+                filter.endLine();
+                lineStart = sendLength + send;
+            }
+            return send;
+        }
+
+        void writeUpstream(const uint8_t* data, size_t length) {
+            size_t sentBytes = 0;
+            while(sentBytes < length) {
+                sentBytes += upstream.Upstream::write(
+                    &data[sentBytes],
+                    length - sentBytes
+                );
+            }
+        }
+
+        void keepBacklog() {
+            for(size_t i = 0; i < sendLength; i++) {
+                size_t end = backlogStart + backlogLength;
+                backlog[end < BacklogSize ? end : end - BacklogSize] = sendBuffer[i];
+                if(backlogLength < BacklogSize) {
+                    backlogLength++;
+                } else {
+                    // Full; forget the oldest byte
+                    if(++backlogStart == BacklogSize) {
+                        backlogStart = 0;
+                    }
+                    backlogDropped++;
+                }
+            }
+        }
+
+        void writeBacklog() {
+            size_t first = BacklogSize - backlogStart;
+            if(first > backlogLength) {
+                first = backlogLength;
+            }
+            writeUpstream(&backlog[backlogStart], first);
+            writeUpstream(backlog, backlogLength - first);
+            backlogStart = 0;
+            backlogLength = 0;
+        }
+
+        void startStream() {
+            compressor.reset();
+            writeUpstream(
+                (const uint8_t*) LZ_STREAM_START,
+                sizeof(LZ_STREAM_START) - 1
+            );
+        }
+
+        void endStream() {
+            const uint8_t end[] = {LZ_FRAME_END, 0};
+            writeUpstream(end, sizeof(end));
+        }
+
+        void writeCompressed() {
+            uint8_t header[2];
+            // Compressed even while paused, to tell when to resume
+            size_t length = compressor.compress(
+                sendBuffer, sendLength, compressed, sendLength - 1
+            );
+            size_t frameLength = (length ? length : sendLength) + sizeof(header);
+
+            if(compressionPaused) {
+                writeUpstream(sendBuffer, sendLength);
+                compressionOutput += sendLength;
+            } else if(length) {
+                header[0] = LZ_FRAME_COMPRESSED;
+                header[1] = length;
+                writeUpstream(header, sizeof(header));
+                writeUpstream(compressed, length);
+                compressionOutput += frameLength;
+            } else {
+                // Didn't compress; send it as-is
+                header[0] = LZ_FRAME_RAW;
+                header[1] = sendLength;
+                writeUpstream(header, sizeof(header));
+                writeUpstream(sendBuffer, sendLength);
+                compressionOutput += frameLength;
+            }
+            compressionInput += sendLength;
+
+            windowInput += sendLength;
+            windowOutput += frameLength;
+            if(windowInput < LZ_RATIO_WINDOW) {
+                return;
+            }
+
+            bool compresses = windowOutput < windowInput;
+            if(compressionPaused && compresses) {
+                compressionPaused = false;
+                startStream();
+            } else if(!compressionPaused && !compresses) {
+                compressionPaused = true;
+                endStream();
+            }
+            windowInput = 0;
+            windowOutput = 0;
+        }
+
+        // Stream calls in this class are qualified with the concrete
+        // type so they bind directly rather than through Stream's vtable.
+        Upstream& upstream;
+        Downstream& downstream;
+
+        uint8_t sendBuffer[SendBufferSize];
+        size_t sendLength = 0;
+        unsigned long lastSend = 0;
+        bool connected = false;
+        FrameDetector framing;
+        LineFilter filter;
+        size_t lineStart = 0;
+        bool atLineStart = true;
+
+        uint8_t backlog[BacklogSize];
+        size_t backlogStart = 0;
+        size_t backlogLength = 0;
+        uint32_t backlogDropped = 0;
+        bool everConnected = false;
+
+        bool compressing = false;
+        StreamCompressor compressor;
+        uint8_t compressed[SendBufferSize];
+        uint32_t compressionInput = 0;
+        uint32_t compressionOutput = 0;
+        bool compressionPaused = false;
+        // Input in the current LZ_RATIO_WINDOW, and the bytes it
+        // would take to send it compressed
+        uint32_t windowInput = 0;
+        uint32_t windowOutput = 0;
+
+        uint8_t escapePos = 0;
+        unsigned long lastEscapeChar = 0;
+};
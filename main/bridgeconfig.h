@@ -0,0 +1,83 @@
+#pragma once
+
+#include "bridge.h"
+#include "sequencer.h"
+
+// Compile-time configuration of the forwarding core and the timing it
+// is subject to.  This header is shared by the firmware and the host
+// builds under `bench/`, so it must not depend on Arduino.h.
+
+// At least this number of ms must elapse between each
+// character of the escape sequence for it to be counted; this
+// is done to prevent legitimate occurrences of the escape sequence
+// occurring in binary causing us to enter the bridge mode.
+#define BT_CTRL_ESCAPE_SEQUENCE_INTERCHARACTER_DELAY 250
+
+// Bytes received from the microcontroller are sent over bluetooth
+// once a newline is received, once this many bytes are waiting, or
+// after MAX_SEND_WAIT ms without further input.
+#define MAX_SEND_WAIT 50
+#define MAX_SEND_BUFFER 128
+
+// Up to this many of the most recent bytes received from the
+// microcontroller before the first client connects (including
+// everything it prints while bluetooth is starting) are sent once one
+// does.
+#define MAX_BACKLOG 1024
+
+// Receiving these bytes over bluetooth (each separated by at least
+// BT_CTRL_ESCAPE_SEQUENCE_INTERCHARACTER_DELAY ms) escapes the bridge
+// and allows you to send commands to the ESP32 unit directly.
+typedef EscapeSequence<'\4', '\4', '\4', '!'> BtCtrlEscapeSequence;
+
+// `reset_uc` holds the microcontroller's nRST low for UC_RESET_PULSE
+// ms.  `flash_uc` raises BOOT0 UC_BOOT0_SETUP ms before that reset and
+// keeps it raised for UC_BOOT0_HOLD ms afterward.
+#define UC_RESET_PULSE 500
+#define UC_BOOT0_SETUP 250
+#define UC_BOOT0_HOLD 500
+
+// The steps `reset_uc` and `flash_uc` run, over pin actions supplied by
+// the user of this template so that host simulations run exactly the
+// sequences the firmware does.  `Done` runs last, once the
+// microcontroller has been released.
+template<
+    void (*NrstLow)(),
+    void (*NrstRelease)(),
+    void (*Boot0High)(),
+    void (*Boot0Low)(),
+    void (*Done)()
+>
+struct UcSequences {
+    static constexpr SequenceStep reset[] = {
+        {NrstLow, UC_RESET_PULSE},
+        {NrstRelease, 0},
+        {Done, 0},
+    };
+    static constexpr SequenceStep flash[] = {
+        {Boot0High, UC_BOOT0_SETUP},
+        {NrstLow, UC_RESET_PULSE},
+        {NrstRelease, UC_BOOT0_HOLD},
+        {Boot0Low, 0},
+        {Done, 0},
+    };
+    static constexpr uint8_t resetLength = sizeof(reset) / sizeof(reset[0]);
+    static constexpr uint8_t flashLength = sizeof(flash) / sizeof(flash[0]);
+};
+
+template<void (*A)(), void (*B)(), void (*C)(), void (*D)(), void (*E)()>
+constexpr SequenceStep UcSequences<A, B, C, D, E>::reset[];
+
+template<void (*A)(), void (*B)(), void (*C)(), void (*D)(), void (*E)()>
+constexpr SequenceStep UcSequences<A, B, C, D, E>::flash[];
+
+template<typename Upstream, typename Downstream>
+using ConfiguredBridge = BridgeCore<
+    Upstream,
+    Downstream,
+    MAX_SEND_BUFFER,
+    MAX_BACKLOG,
+    BtCtrlEscapeSequence,
+    BT_CTRL_ESCAPE_SEQUENCE_INTERCHARACTER_DELAY,
+    MAX_SEND_WAIT
+>;
@@ -4,22 +4,57 @@
 #include "esp_ota_ops.h"
 #include "commands.h"
 #include "main.h"
+#include "linkbench.h"
+#include "sequencer.h"
+#include "sessions.h"
 
-SerialCommand commands(&CmdSerial);
+// Each interface has its own command parser so that commands arriving
+// concurrently on different interfaces can't corrupt one another, and
+// so that replies go only to the interface the command came from.
+SerialCommand serialCommands(&Serial);
+SerialCommand btCommands(&SerialBT);
+// Fed by loop() while BT_KEY is high
+SerialCommand ucCommands(&UCSerial);
+
+SerialCommand* sessions[] = {&serialCommands, &btCommands, &ucCommands};
+#define SESSION_COUNT (sizeof(sessions) / sizeof(sessions[0]))
+
+// The session whose command is currently being run
+SerialCommand* session = &serialCommands;
+uint8_t nextSession = 0;
+
+Sequencer sequencer;
 
 bool connectedHigh = false;
 bool monitorEnabled = false;
 bool escapeEnabled = false;
+bool compressionEnabled = false;
 
 void setupCommands() {
-    commands.addCommand("flash_esp32", flashEsp32);
-    commands.addCommand("flash_uc", flashUC);
-    commands.addCommand("reset_uc", resetUC);
-    commands.addCommand("connected", connected);
-    commands.addCommand("monitor", monitorBridge);
-    commands.addCommand("nrst", setRst);
-    commands.addCommand("unescape", unescape);
-    commands.setDefaultHandler(unrecognized);
+    for(uint8_t i = 0; i < SESSION_COUNT; i++) {
+        SerialCommand* commands = sessions[i];
+
+        commands->addCommand("flash_esp32", flashEsp32);
+        commands->addCommand("flash_uc", flashUC);
+        commands->addCommand("reset_uc", resetUC);
+        commands->addCommand("connected", connected);
+        commands->addCommand("monitor", monitorBridge);
+        commands->addCommand("nrst", setRst);
+        commands->addCommand("unescape", unescapeCommand);
+        commands->addCommand("bench", linkBench);
+        commands->addCommand("framing", setFraming);
+        commands->addCommand("compress", setCompression);
+        commands->addCommand("stats", stats);
+        commands->addCommand("filter", setFilter);
+        commands->setDefaultHandler(unrecognized);
+    }
+    // The microcontroller only needs the replies to its commands
+    ucCommands.disableEcho();
+}
+
+// Replies to the command currently being run
+static Stream& reply() {
+    return *session->getSerial();
 }
 
 void unescape() {
@@ -27,28 +62,59 @@ void unescape() {
     escapeEnabled = false;
 }
 
+void unescapeCommand() {
+    unescape();
+    // Anything more sent to the client now would be mixed into the
+    // microcontroller's output.
+    if(session == &btCommands) {
+        btCommands.skipPrompt();
+    }
+}
+
 void enableEscape() {
+    // Command output is sent uncompressed, so the client needs to be
+    // told that compressed frames have ended before we send any.
+    bridge.setCompression(false, millis());
     CmdSerial.enableInterface(&SerialBT);
     CmdSerial.println("<escape sequence received>");
+    btCommands.clearBuffer();
+    btCommands.skipPrompt(false);
     escapeEnabled = true;
 }
 
 void commandPrompt() {
-    commands.prompt();
+    serialCommands.prompt();
+}
+
+static bool sessionEnabled(SerialCommand* commands) {
+    if(commands == &btCommands) {
+        return escapeEnabled;
+    }
+    return commands != &ucCommands;
 }
 
 void commandLoop() {
-    commands.readSerial();
+    pollSessions(sessions, SESSION_COUNT, nextSession, sessionEnabled, session);
+
+    // Started (or resumed) here rather than by `compress` or `unescape`
+    // so that the prompt after `compress` has been sent before
+    // compression begins.
+    bridge.setCompression(
+        compressionEnabled && !escapeEnabled && bridge.isConnected(),
+        millis()
+    );
+    sequencer.poll(millis());
 }
 
 void commandByte(char inChar) {
-    commands.readChar(inChar);
+    session = &ucCommands;
+    ucCommands.readChar(inChar);
 }
 
 void unrecognized(const char *cmd) {
-    CmdSerial.print("<Unknown command: ");
-    CmdSerial.print(cmd);
-    CmdSerial.println(">");
+    reply().print("<Unknown command: ");
+    reply().print(cmd);
+    reply().println(">");
 }
 
 bool monitorBridgeEnabled() {
@@ -60,7 +126,7 @@ bool escapeIsEnabled() {
 }
 
 void setRst() {
-    char* state = commands.next();
+    char* state = session->next();
 
     if(state == NULL) {
         pinMode(UC_NRST, INPUT);
@@ -76,21 +142,211 @@ void setRst() {
     }
 }
 
+void setFraming() {
+    char* name = session->next();
+
+    if(name == NULL) {
+        reply().println(framingName(bridge.getFraming()));
+        return;
+    }
+
+    Framing framing;
+    if(framingFromName(name, framing)) {
+        bridge.setFraming(framing);
+    } else {
+        reply().print("<Unknown framing: ");
+        reply().print(name);
+        reply().println(">");
+    }
+}
+
+void setCompression() {
+    char* state = session->next();
+
+    // Takes effect from commandLoop(), and only while not escaped
+    if(state != NULL) {
+        compressionEnabled = atoi(state);
+    }
+
+    uint32_t input = bridge.getCompressionInput();
+    uint32_t output = bridge.getCompressionOutput();
+
+    reply().print("<compression: ");
+    reply().print(compressionEnabled ? "1" : "0");
+    reply().print(" paused=");
+    reply().print(bridge.isCompressionPaused() ? "1" : "0");
+    reply().print(" in=");
+    reply().print(input);
+    reply().print(" out=");
+    reply().print(output);
+    reply().print(" ratio=");
+    reply().print(input ? (float) output / input : 1.0, 3);
+    reply().println(">");
+}
+
+// Patterns can't contain spaces as typed, so `\s` stands for a space
+// and `\\` for a backslash; decoded in place.
+static void unescapePattern(char* pattern) {
+    char* output = pattern;
+
+    while(*pattern) {
+        if(pattern[0] == '\\' && pattern[1] == 's') {
+            *output++ = ' ';
+            pattern += 2;
+        } else if(pattern[0] == '\\' && pattern[1] == '\\') {
+            *output++ = '\\';
+            pattern += 2;
+        } else {
+            *output++ = *pattern++;
+        }
+    }
+    *output = '\0';
+}
+
+static void printFilter() {
+    const LineFilter& filter = bridge.getFilter();
+    char pattern[LINE_FILTER_PATTERN_BITS + 1];
+
+    reply().print("<filter: rules=");
+    reply().print(filter.getRuleCount());
+    reply().print(" lines=");
+    reply().print(filter.getLines());
+    reply().print(" dropped=");
+    reply().print(filter.getDroppedLines());
+    reply().print(" dropped_bytes=");
+    reply().print(filter.getDroppedBytes());
+    reply().print(" unmatched=");
+    reply().print(filter.getUnmatched());
+    reply().println(">");
+
+    for(uint8_t i = 0; i < filter.getRuleCount(); i++) {
+        const FilterRule& rule = filter.getRule(i);
+        filter.getPattern(i, pattern);
+
+        reply().print("<rule ");
+        reply().print(i);
+        reply().print(": ");
+        reply().print(FILTER_ACTION_NAMES[rule.action]);
+        reply().print(" ");
+        reply().print(FILTER_MATCH_NAMES[rule.match]);
+        reply().print(" \"");
+        reply().print(pattern);
+        reply().print("\"");
+        if(rule.rate) {
+            reply().print(" rate=");
+            reply().print(rule.rate);
+            reply().print(" burst=");
+            reply().print(rule.burst);
+        }
+        reply().print(" matched=");
+        reply().print(rule.matched);
+        reply().print(" dropped=");
+        reply().print(rule.dropped);
+        reply().println(">");
+    }
+}
+
+void setFilter() {
+    char* first = session->next();
+
+    if(first == NULL) {
+        printFilter();
+        return;
+    }
+    if(strcmp(first, "clear") == 0) {
+        bridge.clearFilterRules();
+        return;
+    }
+    if(strcmp(first, "reset") == 0) {
+        bridge.resetFilterCounters();
+        return;
+    }
+
+    FilterAction action;
+    FilterMatch match;
+    char* matchName = session->next();
+    char* pattern = session->next();
+    char* rate = session->next();
+    char* burst = session->next();
+
+    if(
+        !filterActionFromName(first, action)
+        || matchName == NULL
+        || !filterMatchFromName(matchName, match)
+        || pattern == NULL
+    ) {
+        reply().println(
+            "<filter: expected include|exclude prefix|contains|level "
+            "PATTERN [RATE [BURST]], clear or reset>"
+        );
+        return;
+    }
+
+    unescapePattern(pattern);
+    if(!bridge.addFilterRule(
+        action,
+        match,
+        pattern,
+        rate ? atoi(rate) : 0,
+        burst ? atoi(burst) : 0
+    )) {
+        reply().println("<filter: no room for rule>");
+    }
+}
+
+static const char* const STARTUP_EVENT_NAMES[STARTUP_EVENT_COUNT] = {
+    "begin",
+    "uart_ready",
+    "commands_ready",
+    "first_loop",
+    "bt_ready",
+};
+
+void stats() {
+    // Times are ms since boot; events that haven't happened yet are
+    // shown as '-'.
+    reply().print("<startup:");
+    for(uint8_t i = 0; i < STARTUP_EVENT_COUNT; i++) {
+        unsigned long at = startupTimeline[i];
+
+        reply().print(" ");
+        reply().print(STARTUP_EVENT_NAMES[i]);
+        reply().print("=");
+        if(at) {
+            reply().print(at);
+        } else {
+            reply().print("-");
+        }
+    }
+    reply().println(">");
+
+    reply().print("<backlog: pending=");
+    reply().print(bridge.getBacklog());
+    reply().print(" dropped=");
+    reply().print(bridge.getBacklogDropped());
+    reply().println(">");
+}
+
+void resetCompression() {
+    compressionEnabled = false;
+    bridge.setCompression(false, millis());
+}
+
 void monitorBridge() {
-    char* state = commands.next();
+    char* state = session->next();
 
     if(state == NULL) {
-        Serial.println(monitorEnabled ? "1": "0");
+        reply().println(monitorEnabled ? "1": "0");
         return;
     }
     monitorEnabled = atoi(state);
 }
 
 void connected() {
-    char* state = commands.next();
+    char* state = session->next();
 
     if(state == NULL) {
-        Serial.println(connectedHigh ? "1": "0");
+        reply().println(connectedHigh ? "1": "0");
         return;
     }
 
@@ -104,23 +360,116 @@ void connected() {
     }
 }
 
-void resetUC() {
+static void nrstLow() {
     pinMode(UC_NRST, OUTPUT);
     digitalWrite(UC_NRST, LOW);
-    delay(500);
+}
+
+static void nrstRelease() {
     digitalWrite(UC_NRST, HIGH);
     pinMode(UC_NRST, INPUT);
 }
 
-void flashUC() {
+static void boot0High() {
     digitalWrite(PIN_CONNECTED, HIGH);
-    delay(250);
-    resetUC();
-    delay(500);
+}
+
+static void boot0Low() {
     digitalWrite(PIN_CONNECTED, LOW);
 }
 
+// The session that started the running sequence, and its command
+static SerialCommand* sequenceSession = NULL;
+static const char* sequenceName = NULL;
+
+// Lets scripts wait for the pins to settle before, for example,
+// starting the bootloader handshake.
+static void sequenceDone() {
+    // Would be sent to the microcontroller being reset, or mixed into
+    // the pass-through if the client has unescaped
+    if(
+        sequenceSession == &ucCommands
+        || (sequenceSession == &btCommands && !escapeEnabled)
+    ) {
+        return;
+    }
+    Stream* serial = sequenceSession->getSerial();
+    serial->print("<");
+    serial->print(sequenceName);
+    serial->println(" done>");
+}
+
+typedef UcSequences<
+    nrstLow, nrstRelease, boot0High, boot0Low, sequenceDone
+> Sequences;
+
+// Pin sequences run from commandLoop() so that the bridge keeps
+// forwarding (and, in particular, captures the microcontroller's boot
+// output) while they are in progress.
+static void startSequence(
+    const char* name,
+    const SequenceStep* steps,
+    uint8_t length
+) {
+    if(sequencer.busy()) {
+        reply().println("<busy>");
+        return;
+    }
+    sequenceSession = session;
+    sequenceName = name;
+    sequencer.start(steps, length, millis());
+}
+
+void resetUC() {
+    startSequence("reset_uc", Sequences::reset, Sequences::resetLength);
+}
+
+void flashUC() {
+    startSequence("flash_uc", Sequences::flash, Sequences::flashLength);
+}
+
+void linkBench() {
+    char* mode = session->next();
+    char* bytesArg = session->next();
+    uint32_t bytes = LINK_BENCH_DEFAULT_BYTES;
+
+    if(bytesArg != NULL) {
+        bytes = strtoul(bytesArg, NULL, 10);
+    }
+
+    if(mode == NULL) {
+        reply().println("<bench: expected source, sink, echo or loop>");
+    } else if(strcmp(mode, "loop") != 0 && !btReady) {
+        reply().println("<bluetooth not ready>");
+    } else if(
+        (
+            strcmp(mode, "source") == 0
+            || strcmp(mode, "sink") == 0
+            || strcmp(mode, "echo") == 0
+        ) && !SerialBT.hasClient()
+    ) {
+        // Nothing would be written to or read from SerialBT
+        reply().println("<bench: no bluetooth client>");
+    } else if(strcmp(mode, "source") == 0) {
+        linkBenchSource(SerialBT, bytes, reply());
+    } else if(strcmp(mode, "sink") == 0) {
+        linkBenchSink(SerialBT, bytes, reply());
+    } else if(strcmp(mode, "echo") == 0) {
+        linkBenchEcho(SerialBT, reply());
+    } else if(strcmp(mode, "loop") == 0) {
+        linkBenchLoop(UCSerial, bytes, reply());
+    } else {
+        reply().print("<bench: unknown mode ");
+        reply().print(mode);
+        reply().println(">");
+    }
+}
+
 void flashEsp32() {
+    if(!btReady) {
+        reply().println("<bluetooth not ready>");
+        return;
+    }
     CmdSerial.println("<OTA flash>");
     CmdSerial.flush();
     esp_err_t err;
@@ -1,7 +1,5 @@
 #pragma once
 
-#define OTA_BUFFER_SIZE 1024
-
 void setupCommands();
 void commandPrompt();
 void commandLoop();
@@ -11,11 +9,18 @@ bool monitorBridgeEnabled();
 bool escapeIsEnabled();
 
 void flashEsp32();
+void linkBench();
 void resetUC();
 void flashUC();
 void monitorBridge();
 void connected();
 void setRst();
+void setFraming();
+void setCompression();
+void resetCompression();
+void stats();
+void setFilter();
 void enableEscape();
 void unescape();
+void unescapeCommand();
 void unrecognized(const char *cmd);
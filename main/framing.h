@@ -0,0 +1,133 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Message boundary detection for bytes travelling from the
+// microcontroller to bluetooth.  The send buffer is flushed as soon as
+// a boundary is seen so that short binary responses (an STM32
+// bootloader ACK, a SLIP frame) don't sit in the buffer until
+// MAX_SEND_WAIT runs out.
+
+#define SLIP_END 0xC0
+#define COBS_DELIMITER 0x00
+#define STM32_ACK 0x79
+#define STM32_NACK 0x1F
+
+enum Framing {
+    // Flush only when the send buffer fills or MAX_SEND_WAIT elapses
+    FRAMING_NONE,
+    // Flush after each '\n'
+    FRAMING_LINE,
+    // Flush after each SLIP END byte that closes a non-empty frame
+    FRAMING_SLIP,
+    // Flush after each COBS frame delimiter (0x00)
+    FRAMING_COBS,
+    // Flush after each message having a one-byte length prefix
+    FRAMING_LENGTH8,
+    // Flush after each message having a two-byte big-endian length prefix
+    FRAMING_LENGTH16,
+    // Flush after each STM32 bootloader ACK or NACK
+    FRAMING_STM32,
+};
+
+static const char* const FRAMING_NAMES[] = {
+    "none",
+    "line",
+    "slip",
+    "cobs",
+    "len8",
+    "len16",
+    "stm32",
+};
+
+#define FRAMING_COUNT (sizeof(FRAMING_NAMES) / sizeof(FRAMING_NAMES[0]))
+
+inline const char* framingName(Framing framing) {
+    return FRAMING_NAMES[framing];
+}
+
+// Returns false if `name` is not one of FRAMING_NAMES.
+inline bool framingFromName(const char* name, Framing& framing) {
+    for(size_t i = 0; i < FRAMING_COUNT; i++) {
+        if(strcmp(name, FRAMING_NAMES[i]) == 0) {
+            framing = (Framing) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+class FrameDetector
+{
+    public:
+        FrameDetector(Framing framing = FRAMING_LINE) : framing(framing) {}
+
+        void setFraming(Framing value) {
+            framing = value;
+            reset();
+        }
+
+        Framing getFraming() const {
+            return framing;
+        }
+
+        void reset() {
+            frameLength = 0;
+            headerLength = 0;
+        }
+
+        // Returns true if `value` is the last byte of a message.
+        inline bool boundary(uint8_t value) {
+            switch(framing) {
+                case FRAMING_LINE:
+                    return value == '\n';
+                case FRAMING_SLIP:
+                    // A leading END only separates us from line noise;
+                    // keep it with the frame that follows.
+                    if(value == SLIP_END) {
+                        bool closesFrame = frameLength > 0;
+                        frameLength = 0;
+                        return closesFrame;
+                    }
+                    frameLength++;
+                    return false;
+                case FRAMING_COBS:
+                    return value == COBS_DELIMITER;
+                case FRAMING_LENGTH8:
+                    return lengthPrefixed(value, 1);
+                case FRAMING_LENGTH16:
+                    return lengthPrefixed(value, 2);
+                case FRAMING_STM32:
+                    return value == STM32_ACK || value == STM32_NACK;
+                default:
+                    return false;
+            }
+        }
+
+    private:
+        inline bool lengthPrefixed(uint8_t value, uint8_t headerSize) {
+            if(headerLength < headerSize) {
+                frameLength = (frameLength << 8) | value;
+                headerLength++;
+                if(headerLength == headerSize && frameLength == 0) {
+                    headerLength = 0;
+                    return true;
+                }
+                return false;
+            }
+            if(--frameLength == 0) {
+                headerLength = 0;
+                return true;
+            }
+            return false;
+        }
+
+        Framing framing;
+
+        // SLIP: bytes since the last END; length-prefixed: the length
+        // being read from the header, then the bytes remaining.
+        uint32_t frameLength = 0;
+        uint8_t headerLength = 0;
+};
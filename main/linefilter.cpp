@@ -0,0 +1,180 @@
+#include <string.h>
+
+#include "linefilter.h"
+
+LineFilter::LineFilter() {
+    clearRules();
+}
+
+bool LineFilter::addRule(
+    FilterAction action,
+    FilterMatch match,
+    const char* pattern,
+    uint16_t rate,
+    uint16_t burst
+) {
+    size_t length = strlen(pattern);
+
+    if(ruleCount >= LINE_FILTER_MAX_RULES || length == 0) {
+        return false;
+    }
+    if(
+        match != FILTER_LEVEL
+        && length > (size_t) (LINE_FILTER_PATTERN_BITS - patternLength)
+    ) {
+        return false;
+    }
+
+    FilterRule& rule = rules[ruleCount];
+    memset(&rule, 0, sizeof(rule));
+    rule.action = action;
+    rule.match = match;
+    rule.rate = rate;
+    rule.burst = burst ? burst : (rate ? rate : 1);
+    // Start with a full bucket; the first refill tops it up anyway.
+    rule.tokens = (uint32_t) rule.burst * 1000;
+
+    if(match == FILTER_LEVEL) {
+        for(size_t i = 0; i < length; i++) {
+            rule.levels |= levelBit(pattern[i]);
+        }
+        if(!rule.levels) {
+            return false;
+        }
+    } else {
+        rule.start = patternLength;
+        rule.length = length;
+        memcpy(&patterns[patternLength], pattern, length);
+        patternLength += length;
+    }
+
+    if(action == FILTER_INCLUDE) {
+        includeCount++;
+    }
+    ruleCount++;
+    rebuild();
+    return true;
+}
+
+void LineFilter::clearRules() {
+    ruleCount = 0;
+    includeCount = 0;
+    patternLength = 0;
+    rebuild();
+}
+
+void LineFilter::resetCounters() {
+    for(uint8_t i = 0; i < ruleCount; i++) {
+        rules[i].matched = 0;
+        rules[i].dropped = 0;
+    }
+    lines = 0;
+    droppedLines = 0;
+    droppedBytes = 0;
+    unmatched = 0;
+}
+
+void LineFilter::getPattern(uint8_t index, char* output) const {
+    const FilterRule& rule = rules[index];
+
+    if(rule.match == FILTER_LEVEL) {
+        for(uint8_t i = 0; i < 26; i++) {
+            if(rule.levels & (1UL << i)) {
+                *output++ = 'A' + i;
+            }
+        }
+    } else {
+        memcpy(output, &patterns[rule.start], rule.length);
+        output += rule.length;
+    }
+    *output = '\0';
+}
+
+void LineFilter::rebuild() {
+    memset(masks, 0, sizeof(masks));
+    allStarts = 0;
+    containsStarts = 0;
+    ends = 0;
+
+    for(uint8_t i = 0; i < ruleCount; i++) {
+        const FilterRule& rule = rules[i];
+        if(rule.match == FILTER_LEVEL) {
+            continue;
+        }
+
+        for(uint8_t j = 0; j < rule.length; j++) {
+            masks[(uint8_t) patterns[rule.start + j]] |= 1UL << (rule.start + j);
+        }
+        allStarts |= 1UL << rule.start;
+        if(rule.match == FILTER_CONTAINS) {
+            containsStarts |= 1UL << rule.start;
+        }
+        ends |= 1UL << (rule.start + rule.length - 1);
+    }
+
+    endLine();
+}
+
+bool LineFilter::ruleMatches(const FilterRule& rule) const {
+    if(rule.match == FILTER_LEVEL) {
+        return level & rule.levels;
+    }
+    return matched & (1UL << (rule.start + rule.length - 1));
+}
+
+bool LineFilter::takeToken(FilterRule& rule, unsigned long now) {
+    if(!rule.rate) {
+        return true;
+    }
+
+    uint32_t capacity = (uint32_t) rule.burst * 1000;
+    uint32_t elapsed = now - rule.lastRefill;
+    rule.lastRefill = now;
+
+    // Compared this way round so that a long gap can't overflow
+    if(elapsed >= capacity / rule.rate) {
+        rule.tokens = capacity;
+    } else {
+        rule.tokens += elapsed * rule.rate;
+        if(rule.tokens > capacity) {
+            rule.tokens = capacity;
+        }
+    }
+
+    if(rule.tokens < 1000) {
+        return false;
+    }
+    rule.tokens -= 1000;
+    return true;
+}
+
+bool LineFilter::decide(unsigned long now, size_t bytes) {
+    bool send = includeCount == 0;
+    bool decided = false;
+
+    lines++;
+    for(uint8_t i = 0; i < ruleCount && !decided; i++) {
+        FilterRule& rule = rules[i];
+        if(!ruleMatches(rule)) {
+            continue;
+        }
+
+        decided = true;
+        rule.matched++;
+        send = rule.action == FILTER_INCLUDE && takeToken(rule, now);
+        if(!send) {
+            rule.dropped++;
+        }
+    }
+
+    if(!decided && !send) {
+        unmatched++;
+    }
+    if(!send) {
+        droppedLines++;
+        droppedBytes += bytes;
+    }
+
+    verdict = send ? VERDICT_SEND : VERDICT_DROP;
+    return send;
+}
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Per-line filtering of bytes travelling from the microcontroller to
+// bluetooth, so that debug chatter can be kept off the link.
+//
+// Each rule matches lines that start with (`prefix`) or contain
+// (`contains`) a pattern, or whose log level tag is one of a set of
+// letters (`level`; the tag is the first letter of the line, or the
+// first after a leading '[' or '<', so `E (123) wifi: ...` and
+// `[E] ...` are both level E).  The first rule matching a line
+// decides it: `exclude` rules drop it, `include` rules send it -- at
+// up to `rate` lines per second with bursts of up to `burst` lines, if
+// a rate is set.  Lines matching no rule are dropped if there are any
+// include rules, and sent otherwise.
+//
+// All prefix and contains patterns are matched at once by a single
+// shift-and automaton, so the work done per byte doesn't depend on the
+// number or length of the rules; rules are only consulted once per
+// line.  The patterns of all rules together may be at most
+// LINE_FILTER_PATTERN_BITS (the width of the automaton's state) bytes
+// long.
+
+#define LINE_FILTER_MAX_RULES 8
+#define LINE_FILTER_PATTERN_BITS 32
+
+enum FilterAction {
+    FILTER_INCLUDE,
+    FILTER_EXCLUDE,
+};
+
+enum FilterMatch {
+    FILTER_PREFIX,
+    FILTER_CONTAINS,
+    FILTER_LEVEL,
+};
+
+static const char* const FILTER_ACTION_NAMES[] = {
+    "include",
+    "exclude",
+};
+
+static const char* const FILTER_MATCH_NAMES[] = {
+    "prefix",
+    "contains",
+    "level",
+};
+
+#define FILTER_ACTION_COUNT \
+    (sizeof(FILTER_ACTION_NAMES) / sizeof(FILTER_ACTION_NAMES[0]))
+#define FILTER_MATCH_COUNT \
+    (sizeof(FILTER_MATCH_NAMES) / sizeof(FILTER_MATCH_NAMES[0]))
+
+// Returns false if `name` is not one of FILTER_ACTION_NAMES.
+inline bool filterActionFromName(const char* name, FilterAction& action) {
+    for(size_t i = 0; i < FILTER_ACTION_COUNT; i++) {
+        if(strcmp(name, FILTER_ACTION_NAMES[i]) == 0) {
+            action = (FilterAction) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns false if `name` is not one of FILTER_MATCH_NAMES.
+inline bool filterMatchFromName(const char* name, FilterMatch& match) {
+    for(size_t i = 0; i < FILTER_MATCH_COUNT; i++) {
+        if(strcmp(name, FILTER_MATCH_NAMES[i]) == 0) {
+            match = (FilterMatch) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+struct FilterRule {
+    FilterAction action;
+    FilterMatch match;
+    // Lines per second let through by an include rule; 0 for no limit
+    uint16_t rate;
+    uint16_t burst;
+
+    // Lines this rule decided, and how many of those it dropped
+    // (every one, for an exclude rule; those over the rate limit, for
+    // an include rule).
+    uint32_t matched;
+    uint32_t dropped;
+
+    // prefix/contains: position of the pattern in the automaton
+    uint8_t start;
+    uint8_t length;
+    // level: bit N set for the letter 'A' + N
+    uint32_t levels;
+
+    // Token bucket, in thousandths of a line
+    uint32_t tokens;
+    unsigned long lastRefill;
+};
+
+class LineFilter
+{
+    public:
+        LineFilter();
+
+        // Adds a rule after the existing ones; `pattern` is the
+        // pattern for prefix/contains rules or the level letters for
+        // level rules.  Returns false if there is no room for it.
+        bool addRule(
+            FilterAction action,
+            FilterMatch match,
+            const char* pattern,
+            uint16_t rate = 0,
+            uint16_t burst = 0
+        );
+        void clearRules();
+        void resetCounters();
+
+        uint8_t getRuleCount() const {
+            return ruleCount;
+        }
+
+        const FilterRule& getRule(uint8_t index) const {
+            return rules[index];
+        }
+
+        // Writes the pattern (or level letters) of a rule to `output`,
+        // which must have room for LINE_FILTER_PATTERN_BITS + 1 bytes.
+        void getPattern(uint8_t index, char* output) const;
+
+        // Lines seen while there were rules, lines dropped (and the
+        // bytes in them), and lines dropped for matching no rule.
+        uint32_t getLines() const {
+            return lines;
+        }
+
+        uint32_t getDroppedLines() const {
+            return droppedLines;
+        }
+
+        uint32_t getDroppedBytes() const {
+            return droppedBytes;
+        }
+
+        uint32_t getUnmatched() const {
+            return unmatched;
+        }
+
+        inline bool active() const {
+            return ruleCount > 0;
+        }
+
+        // True until `decide` has been called for the current line.
+        inline bool undecided() const {
+            return verdict == VERDICT_UNDECIDED;
+        }
+
+        inline bool dropping() const {
+            return verdict == VERDICT_DROP;
+        }
+
+        // Advances the matchers over the next byte of an undecided line.
+        inline void feed(uint8_t value) {
+            uint32_t inject = atStart ? allStarts : containsStarts;
+            state = (((state << 1) & ~allStarts) | inject) & masks[value];
+            matched |= state & ends;
+
+            if(!levelKnown && !(atStart && (value == '[' || value == '<'))) {
+                level = levelBit(value);
+                levelKnown = true;
+            }
+            atStart = false;
+        }
+
+        // Decides the current line using what has been seen of it so
+        // far; `bytes` is its length so far.  Returns true if it should
+        // be sent.
+        bool decide(unsigned long now, size_t bytes);
+
+        // Counts `bytes` more bytes of a line being dropped.
+        inline void countDropped(size_t bytes) {
+            droppedBytes += bytes;
+        }
+
+        // Sends the rest of the current line without matching it.
+        void skipLine() {
+            endLine();
+            verdict = VERDICT_SEND;
+        }
+
+        // Starts matching a new line.
+        inline void endLine() {
+            verdict = VERDICT_UNDECIDED;
+            state = 0;
+            matched = 0;
+            atStart = true;
+            levelKnown = false;
+            level = 0;
+        }
+
+    private:
+        enum Verdict {
+            VERDICT_UNDECIDED,
+            VERDICT_SEND,
+            VERDICT_DROP,
+        };
+
+        static inline uint32_t levelBit(uint8_t value) {
+            if(value >= 'a' && value <= 'z') {
+                value -= 'a' - 'A';
+            }
+            if(value >= 'A' && value <= 'Z') {
+                return 1UL << (value - 'A');
+            }
+            return 0;
+        }
+
+        bool ruleMatches(const FilterRule& rule) const;
+        bool takeToken(FilterRule& rule, unsigned long now);
+        void rebuild();
+
+        FilterRule rules[LINE_FILTER_MAX_RULES];
+        uint8_t ruleCount = 0;
+        uint8_t includeCount = 0;
+
+        // Pattern bytes of every prefix/contains rule, back to back
+        char patterns[LINE_FILTER_PATTERN_BITS];
+        uint8_t patternLength = 0;
+
+        // Shift-and automaton: bit N of masks[c] is set if byte N of
+        // `patterns` is c.  Each pattern's first bit is injected into
+        // `state` before every byte (contains) or before the first
+        // byte of a line (prefix), and it has matched once its last
+        // bit comes out of the mask.
+        uint32_t masks[256];
+        uint32_t allStarts = 0;
+        uint32_t containsStarts = 0;
+        uint32_t ends = 0;
+
+        // The current line
+        Verdict verdict = VERDICT_UNDECIDED;
+        uint32_t state = 0;
+        uint32_t matched = 0;
+        bool atStart = true;
+        bool levelKnown = false;
+        uint32_t level = 0;
+
+        uint32_t lines = 0;
+        uint32_t droppedLines = 0;
+        uint32_t droppedBytes = 0;
+        uint32_t unmatched = 0;
+};
@@ -0,0 +1,249 @@
+#include <algorithm>
+
+#include "linkbench.h"
+
+#define LINK_BENCH_READY "<bench ready>"
+
+static void reportResult(
+    Print& report,
+    const char* mode,
+    uint32_t bytes,
+    uint32_t lost,
+    uint32_t errors,
+    unsigned long elapsed
+) {
+    report.print("<bench ");
+    report.print(mode);
+    report.print(": bytes=");
+    report.print(bytes);
+    report.print(" ms=");
+    report.print(elapsed);
+    report.print(" bytes_per_sec=");
+    report.print(elapsed ? (uint32_t)((uint64_t)bytes * 1000 / elapsed) : 0);
+    report.print(" lost=");
+    report.print(lost);
+    report.print(" errors=");
+    report.print(errors);
+}
+
+static void fillPattern(uint8_t* buffer, uint32_t position, size_t length) {
+    for(size_t i = 0; i < length; i++) {
+        buffer[i] = linkBenchPattern(position + i);
+    }
+}
+
+// Position (after `position`, and before `bytes`) at which `value`
+// next appears in the pattern, or 0 if it doesn't within
+// LINK_BENCH_MAX_GAP bytes.
+static uint32_t findGapEnd(uint8_t value, uint32_t position, uint32_t bytes) {
+    uint32_t last = std::min(position + LINK_BENCH_MAX_GAP, bytes - 1);
+    for(uint32_t candidate = position + 1; candidate <= last; candidate++) {
+        if(linkBenchPattern(candidate) == value) {
+            return candidate;
+        }
+    }
+    return 0;
+}
+
+void linkBenchSource(Stream& link, uint32_t bytes, Print& report) {
+    uint8_t chunk[LINK_BENCH_PACKET_SIZE];
+    uint32_t sent = 0;
+
+    report.println(LINK_BENCH_READY);
+
+    unsigned long started = millis();
+    while(sent < bytes) {
+        size_t length = std::min((uint32_t)sizeof(chunk), bytes - sent);
+        fillPattern(chunk, sent, length);
+        size_t written = link.write(chunk, length);
+        if(written == 0) {
+            // The client has gone away
+            break;
+        }
+        sent += written;
+    }
+    link.flush();
+
+    reportResult(
+        report, "source", sent, bytes - sent, 0, millis() - started
+    );
+    report.println(">");
+}
+
+void linkBenchSink(Stream& link, uint32_t bytes, Print& report) {
+    uint32_t received = 0;
+    uint32_t errors = 0;
+    // Position in the pattern of the next byte
+    uint32_t position = 0;
+    // Position of the last byte if it followed a gap, until the next
+    // byte confirms it; 0 if it didn't
+    uint32_t gapEnd = 0;
+    unsigned long started = 0;
+    unsigned long lastData = millis();
+
+    report.println(LINK_BENCH_READY);
+
+    while(received < bytes && position < bytes) {
+        if(!link.available()) {
+            if(millis() - lastData > LINK_BENCH_IDLE_TIMEOUT) {
+                break;
+            }
+            continue;
+        }
+
+        int value = link.read();
+        if(value == -1) {
+            continue;
+        }
+        lastData = millis();
+        if(received == 0) {
+            started = lastData;
+        }
+        received++;
+
+        if(gapEnd) {
+            uint32_t previous = gapEnd;
+            gapEnd = 0;
+            if((uint8_t)value == linkBenchPattern(previous + 1)) {
+                position = previous + 2;
+                continue;
+            }
+            errors++;
+            position++;
+        }
+
+        if((uint8_t)value == linkBenchPattern(position)) {
+            position++;
+            continue;
+        }
+
+        uint32_t candidate = findGapEnd(value, position, bytes);
+        if(!candidate) {
+            errors++;
+            position++;
+        } else if(candidate + 1 < bytes) {
+            gapEnd = candidate;
+        } else {
+            // Nothing more will come to confirm the last byte
+            position = candidate + 1;
+        }
+    }
+
+    reportResult(
+        report, "sink", received, bytes - received, errors,
+        received ? lastData - started : 0
+    );
+    report.println(">");
+}
+
+void linkBenchEcho(Stream& link, Print& report) {
+    uint8_t chunk[LINK_BENCH_PACKET_SIZE];
+    uint32_t echoed = 0;
+    uint32_t lost = 0;
+    unsigned long started = 0;
+    unsigned long lastData = millis();
+
+    report.println(LINK_BENCH_READY);
+
+    while(!lost && millis() - lastData <= LINK_BENCH_IDLE_TIMEOUT) {
+        int available = link.available();
+        if(available <= 0) {
+            continue;
+        }
+
+        size_t length = link.readBytes(
+            chunk, std::min((size_t)available, sizeof(chunk))
+        );
+        size_t written = 0;
+        while(written < length) {
+            size_t count = link.write(&chunk[written], length - written);
+            if(count == 0) {
+                // The client has gone away
+                lost = length - written;
+                break;
+            }
+            written += count;
+        }
+
+        lastData = millis();
+        if(echoed == 0) {
+            started = lastData;
+        }
+        echoed += written;
+    }
+
+    reportResult(
+        report, "echo", echoed, lost, 0, echoed ? lastData - started : 0
+    );
+    report.println(">");
+}
+
+void linkBenchLoop(Stream& link, uint32_t bytes, Print& report) {
+    uint8_t chunk[LINK_BENCH_PACKET_SIZE];
+    uint32_t samples[LINK_BENCH_MAX_SAMPLES];
+    uint32_t packets = 0;
+    uint32_t sent = 0;
+    uint32_t received = 0;
+    uint32_t errors = 0;
+    uint8_t timeouts = 0;
+
+    while(link.available()) {
+        link.read();
+    }
+
+    report.println(LINK_BENCH_READY);
+
+    unsigned long started = millis();
+    while(sent < bytes && timeouts < LINK_BENCH_MAX_TIMEOUTS) {
+        size_t length = std::min((uint32_t)sizeof(chunk), bytes - sent);
+        fillPattern(chunk, sent, length);
+
+        unsigned long packetStarted = micros();
+        link.write(chunk, length);
+
+        size_t returned = 0;
+        while(
+            returned < length
+            && micros() - packetStarted < LINK_BENCH_PACKET_TIMEOUT
+        ) {
+            int value = link.read();
+            if(value == -1) {
+                continue;
+            }
+            if((uint8_t)value != chunk[returned]) {
+                errors++;
+            }
+            returned++;
+        }
+        if(returned == length) {
+            samples[packets % LINK_BENCH_MAX_SAMPLES] = micros() - packetStarted;
+            packets++;
+            timeouts = 0;
+        } else {
+            timeouts++;
+        }
+
+        sent += length;
+        received += returned;
+    }
+    unsigned long elapsed = millis() - started;
+
+    uint32_t sampleCount = std::min(packets, (uint32_t)LINK_BENCH_MAX_SAMPLES);
+    std::sort(samples, samples + sampleCount);
+
+    reportResult(report, "loop", received, sent - received, errors, elapsed);
+    if(sampleCount) {
+        report.print(" rtt_p50_us=");
+        report.print(samples[(sampleCount - 1) * 50 / 100]);
+        report.print(" rtt_p90_us=");
+        report.print(samples[(sampleCount - 1) * 90 / 100]);
+        report.print(" rtt_p99_us=");
+        report.print(samples[(sampleCount - 1) * 99 / 100]);
+        report.print(" rtt_max_us=");
+        report.print(samples[sampleCount - 1]);
+    }
+    if(timeouts >= LINK_BENCH_MAX_TIMEOUTS) {
+        report.print(" aborted=1");
+    }
+    report.println(">");
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Diagnostics for the `bench` command; see programming/link_bench.py
+// for the host side of each mode.
+
+// Number of bytes transferred when `bench` is not given a count
+#define LINK_BENCH_DEFAULT_BYTES 65536
+
+// Sink and echo modes end once nothing has been received for this
+// many ms.
+#define LINK_BENCH_IDLE_TIMEOUT 2000
+
+// Sink mode takes a byte that doesn't match the pattern, but does
+// match it up to this many bytes further on (and is followed by the
+// byte after that), to mean bytes were lost rather than corrupted.
+#define LINK_BENCH_MAX_GAP 1024
+
+// Loop mode sends packets of this size and waits (at most
+// LINK_BENCH_PACKET_TIMEOUT us) for each to return before sending the
+// next; RTT percentiles are computed over the most recent
+// LINK_BENCH_MAX_SAMPLES packets.
+#define LINK_BENCH_PACKET_SIZE 32
+#define LINK_BENCH_PACKET_TIMEOUT 100000
+#define LINK_BENCH_MAX_SAMPLES 256
+
+// Loop mode gives up after this many packets in a row have timed out
+// (e.g. because UC_TX isn't jumpered to UC_RX) rather than blocking
+// loop() for every remaining packet's timeout.
+#define LINK_BENCH_MAX_TIMEOUTS 5
+
+// The byte expected at `position` of a benchmark transfer; mirrors
+// `pattern()` in programming/link_bench.py.
+inline uint8_t linkBenchPattern(uint32_t position) {
+    return (uint8_t)(position + (position >> 8));
+}
+
+// Writes `bytes` bytes of the pattern to `link`; stops early (counting
+// the rest as lost) if `link` stops accepting bytes.
+void linkBenchSource(Stream& link, uint32_t bytes, Print& report);
+
+// Reads up to `bytes` bytes of the pattern from `link`, counting
+// bytes that do not match; picks the pattern up again after a gap of
+// lost bytes.
+void linkBenchSink(Stream& link, uint32_t bytes, Print& report);
+
+// Writes everything received on `link` back to it, stopping if `link`
+// stops accepting bytes.
+void linkBenchEcho(Stream& link, Print& report);
+
+// Sends `bytes` bytes of the pattern to `link` and reads them back;
+// requires the link's TX and RX to be connected to one another.
+// Reports `aborted=1` if it gave up after LINK_BENCH_MAX_TIMEOUTS.
+void linkBenchLoop(Stream& link, uint32_t bytes, Print& report);
@@ -0,0 +1,96 @@
+#include <string.h>
+
+#include "lzstream.h"
+
+StreamCompressor::StreamCompressor() {
+    reset();
+}
+
+void StreamCompressor::reset() {
+    memset(window, 0, sizeof(window));
+    memset(candidates, 0, sizeof(candidates));
+    position = 0;
+}
+
+size_t StreamCompressor::compress(
+    const uint8_t* input,
+    size_t length,
+    uint8_t* output,
+    size_t capacity
+) {
+    uint32_t current = position;
+    uint32_t end = position + length;
+
+    for(size_t i = 0; i < length; i++) {
+        window[(current + i) & (LZ_WINDOW_SIZE - 1)] = input[i];
+    }
+    position = end;
+
+    // Anything older than this has just been overwritten by `input`
+    uint32_t oldest = end > LZ_WINDOW_SIZE ? end - LZ_WINDOW_SIZE : 0;
+
+    size_t outputLength = 0;
+    size_t flagIndex = 0;
+    uint8_t item = 8;
+
+    while(current < end) {
+        if(item == 8) {
+            if(outputLength >= capacity) {
+                return 0;
+            }
+            flagIndex = outputLength;
+            output[outputLength++] = 0;
+            item = 0;
+        }
+
+        uint32_t matchLength = 0;
+        uint32_t distance = 0;
+        if(end - current >= LZ_MIN_MATCH) {
+            uint8_t key = hash(current);
+            // Stored off by one so that zero means "never seen"
+            uint32_t candidate = candidates[key];
+            candidates[key] = current + 1;
+
+            if(candidate-- && candidate >= oldest) {
+                uint32_t limit = end - current;
+                if(limit > LZ_MAX_MATCH) {
+                    limit = LZ_MAX_MATCH;
+                }
+                while(
+                    matchLength < limit
+                    && at(candidate + matchLength) == at(current + matchLength)
+                ) {
+                    matchLength++;
+                }
+                distance = current - candidate;
+            }
+        }
+
+        if(matchLength >= LZ_MIN_MATCH) {
+            if(outputLength + 2 > capacity) {
+                return 0;
+            }
+            output[flagIndex] |= 1 << item;
+            output[outputLength++] = (distance - 1) & 0xff;
+            output[outputLength++] =
+                (((distance - 1) >> 8) << 6) | (matchLength - LZ_MIN_MATCH);
+
+            for(uint32_t skipped = current + 1; skipped < current + matchLength; skipped++) {
+                if(end - skipped < LZ_MIN_MATCH) {
+                    break;
+                }
+                candidates[hash(skipped)] = skipped + 1;
+            }
+            current += matchLength;
+        } else {
+            if(outputLength >= capacity) {
+                return 0;
+            }
+            output[outputLength++] = at(current);
+            current++;
+        }
+        item++;
+    }
+
+    return outputLength;
+}
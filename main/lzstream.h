@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Streaming LZSS compressor for the microcontroller->bluetooth
+// direction; see `programming/lzstream.py` for the matching decoder.
+//
+// Each call to `compress` encodes one block (one flush of the send
+// buffer), but matches may refer to anything sent in the previous
+// LZ_WINDOW_SIZE bytes, so repetitive log output compresses well even
+// though blocks are short.  The decoder must see every block -- raw or
+// compressed -- in order to keep its window in step.
+//
+// Block encoding: a flag byte precedes each group of eight items; bit
+// N (LSB first) is set if item N is a match.  A literal is one byte; a
+// match is two bytes, the low eight bits of (distance - 1) followed by
+// the high two bits of (distance - 1) in bits 6-7 and (length -
+// LZ_MIN_MATCH) in bits 0-5.
+
+// Once compression is enabled, the bridge announces it by sending
+// LZ_STREAM_START, then sends each flush of the send buffer as a frame
+// of [kind, payload length, payload...]; LZ_FRAME_END (with an empty
+// payload) returns the link to raw bytes.  Blocks that do not compress
+// are sent as LZ_FRAME_RAW.
+//
+// The bridge keeps track of how well each LZ_RATIO_WINDOW bytes of
+// input would compress.  If a window would be sent in no fewer bytes
+// than it holds, it ends the stream with LZ_FRAME_END and sends raw
+// bytes until a window would compress, at which point it starts a new
+// stream with LZ_STREAM_START.
+#define LZ_STREAM_START "<compression on>\r\n"
+#define LZ_FRAME_RAW 0x00
+#define LZ_FRAME_COMPRESSED 0x01
+#define LZ_FRAME_END 0x02
+
+#define LZ_WINDOW_SIZE 1024
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH (LZ_MIN_MATCH + 63)
+#define LZ_HASH_SIZE 256
+#define LZ_RATIO_WINDOW 512
+
+class StreamCompressor
+{
+    public:
+        StreamCompressor();
+
+        // Forgets all history; the decoder must be reset at the same
+        // point in the stream.
+        void reset();
+
+        // Compresses `length` bytes of `input` into `output`, returning
+        // the compressed size, or 0 if it would not fit in `capacity`
+        // bytes.  Either way `input` is added to the window, so the
+        // caller must send it raw if 0 is returned.
+        size_t compress(
+            const uint8_t* input,
+            size_t length,
+            uint8_t* output,
+            size_t capacity
+        );
+
+    private:
+        inline uint8_t at(uint32_t position) const {
+            return window[position & (LZ_WINDOW_SIZE - 1)];
+        }
+        inline uint8_t hash(uint32_t position) const {
+            return (at(position) * 33 + at(position + 1) * 7 + at(position + 2))
+                & (LZ_HASH_SIZE - 1);
+        }
+
+        uint8_t window[LZ_WINDOW_SIZE];
+        // Most recent stream position at which each hash was seen
+        uint32_t candidates[LZ_HASH_SIZE];
+        // Number of bytes added to the window since `reset`
+        uint32_t position;
+};
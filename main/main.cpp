@@ -11,90 +11,109 @@
 #error Bluetooth is not enabled! Please run `make menuconfig` to and enable it
 #endif
 
-char BT_CTRL_ESCAPE_SEQUENCE[] = {'\4', '\4', '\4', '!'};
-uint8_t BT_CTRL_ESCAPE_SEQUENCE_LENGTH = sizeof(BT_CTRL_ESCAPE_SEQUENCE)/sizeof(BT_CTRL_ESCAPE_SEQUENCE[0]);
-
 BluetoothSerial SerialBT;
-unsigned long lastSend = 0;
 bool isConnected = false;
 bool btKeyHigh = false;
-String sendBuffer;
 String commandBuffer;
 
-int8_t escapeSequencePos = 0;
-unsigned long lastEscapeSequenceChar = 0;
-
 bool bridgeInit = false;
 bool ucTx = false;
 
+// Set by btInitTask once SerialBT may be used
+volatile bool btStarted = false;
+bool btReady = false;
+
 HardwareSerial UCSerial(1);
 MultiSerial CmdSerial;
+Bridge bridge(SerialBT, UCSerial);
+
+// Zero until the corresponding event has happened
+volatile unsigned long startupTimeline[STARTUP_EVENT_COUNT] = {0};
+
+void recordStartup(StartupEvent event) {
+    if(!startupTimeline[event]) {
+        startupTimeline[event] = millis();
+    }
+}
+
+// Bringing up Bluedroid takes most of a second, so it runs on the other
+// core while loop() starts bridging the microcontroller UART.
+void btInitTask(void*) {
+    SerialBT.begin(BT_NAME);
+    recordStartup(STARTUP_BT_READY);
+    btStarted = true;
+    vTaskDelete(NULL);
+}
 
 void setup() {
+    recordStartup(STARTUP_BEGIN);
+
     pinMode(BT_KEY, INPUT_PULLDOWN);
     pinMode(PIN_CONNECTED, OUTPUT);
     digitalWrite(PIN_CONNECTED, LOW);
     pinMode(UC_NRST, INPUT);
 
-    SerialBT.begin(BT_NAME);
     Serial.begin(115200);
     UCSerial.begin(230400, SERIAL_8E1, UC_RX, UC_TX);
-    UCSerial.setRxBufferSize(1024);
+    UCSerial.setRxBufferSize(UC_RX_BUFFER);
+    recordStartup(STARTUP_UART_READY);
+
+    xTaskCreatePinnedToCore(btInitTask, "btInit", 8192, NULL, 1, NULL, 0);
 
     CmdSerial.addInterface(&Serial);
     CmdSerial.addInterface(&SerialBT);
     CmdSerial.addInterface(&UCSerial);
+    CmdSerial.disableInterface(&SerialBT);
+    CmdSerial.disableInterface(&UCSerial);
 
-    sendBuffer.reserve(MAX_SEND_BUFFER);
     commandBuffer.reserve(MAX_CMD_BUFFER);
 
     setupCommands();
 
-    while(CmdSerial.available()) {
-        CmdSerial.read();
+    // Discard anything received on UART0 during boot; the
+    // microcontroller's output is left for loop() to forward.
+    while(Serial.available()) {
+        Serial.read();
     }
-    CmdSerial.disableInterface(&SerialBT);
-    CmdSerial.disableInterface(&UCSerial);
 
     Serial.print("<Serial Bridge Ready: ");
     Serial.print(BT_NAME);
     Serial.println(">");
     commandPrompt();
+    recordStartup(STARTUP_COMMANDS_READY);
 
-    #ifdef PIN_READY
-        digitalWrite(PIN_READY, HIGH);
-        pinMode(PIN_READY, OUTPUT);
+    #ifdef PIN_UART_READY
+        digitalWrite(PIN_UART_READY, HIGH);
+        pinMode(PIN_UART_READY, OUTPUT);
     #endif
 }
 
-void sendBufferNow() {
-    int sentBytes = 0;
-    if(isConnected) {
-        if(sendBuffer.length() > 0) {
-            while(sentBytes < sendBuffer.length()) {
-                sentBytes += SerialBT.write(
-                    &(((const uint8_t*)sendBuffer.c_str())[sentBytes]),
-                    sendBuffer.length() - sentBytes
-                );
-            }
-        }
-    }
-    sendBuffer = "";
-    lastSend = millis();
-}
-
 void loop() {
+    recordStartup(STARTUP_FIRST_LOOP);
     commandLoop();
 
-    bool _connected = SerialBT.hasClient();
+    if(btStarted != btReady) {
+        btReady = btStarted;
+        Serial.println("<Bluetooth Ready>");
+
+        #ifdef PIN_BT_READY
+            digitalWrite(PIN_BT_READY, HIGH);
+            pinMode(PIN_BT_READY, OUTPUT);
+        #endif
+    }
+
+    bool _connected = btReady && SerialBT.hasClient();
 
     if(isConnected != _connected) {
         isConnected = _connected;
+        bridge.setConnected(isConnected);
 
         if(isConnected) {
             Serial.println("<Client Connected>");
         } else {
             Serial.println("<Client Disconnected>");
+            // Compression is negotiated by each client
+            resetCompression();
             unescape();
         }
         digitalWrite(PIN_CONNECTED, isConnected);
@@ -130,19 +149,13 @@ void loop() {
                     Serial.print((char)read);
                 }
 
-                sendBuffer += (char)read;
-                if(
-                    ((char)read == '\n') 
-                    || sendBuffer.length() >= (MAX_SEND_BUFFER - 1)
-                ) {
-                    sendBufferNow();
-                }
+                bridge.fromDownstream(read, millis());
             }
         }
-    } else if (millis() - lastSend > MAX_SEND_WAIT) {
-        sendBufferNow();
+    } else {
+        bridge.idle(millis());
     }
-    if(!escapeIsEnabled()) {
+    if(btReady && !escapeIsEnabled()) {
         if(SerialBT.available()) {
             int read = SerialBT.read();
 
@@ -156,21 +169,7 @@ void loop() {
                     }
                     Serial.print((char)read);
                 }
-                UCSerial.write((char)read);
-                if(
-                    read == BT_CTRL_ESCAPE_SEQUENCE[escapeSequencePos]
-                    && (
-                        millis() > (
-                            lastEscapeSequenceChar + BT_CTRL_ESCAPE_SEQUENCE_INTERCHARACTER_DELAY
-                        )
-                    )
-                ) {
-                    lastEscapeSequenceChar = millis();
-                    escapeSequencePos++;
-                } else {
-                    escapeSequencePos = 0;
-                }
-                if(escapeSequencePos == BT_CTRL_ESCAPE_SEQUENCE_LENGTH) {
+                if(bridge.fromUpstream(read, millis())) {
                     enableEscape();
                 }
             }
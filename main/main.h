@@ -3,16 +3,11 @@
 #include "Arduino.h"
 #include "BluetoothSerial.h"
 #include "multiserial.h"
+#include "bridgeconfig.h"
 
 // This is the name that this device will appear under during discovery
 #define BT_NAME "esp32-bridge"
 
-// At least this number of ms must elapse between each
-// character of the escape sequence for it to be counted; this
-// is done to prevent legitimate occurrences of the escape sequence
-// occurring in binary causing us to enter the bridge mode.
-#define BT_CTRL_ESCAPE_SEQUENCE_INTERCHARACTER_DELAY 250
-
 // For communicating with the microcontroller, we will transmit and
 // receive on the following pins.  Do not set these to match the pins
 // used by defualt for the ESP32 unit's UART1 (IO35 and IO34).  I've also
@@ -22,9 +17,14 @@
 #define UC_TX 27
 #define UC_RX 14
 
+// This pin will be pulled HIGH (if defined) once the microcontroller
+// UART is being bridged and commands are accepted; this happens before
+// bluetooth is available.
+// #define PIN_UART_READY 18
+
 // This pin will be pulled HIGH (if defined) when the device is
-// ready for connections
-#define PIN_READY 5
+// ready for bluetooth connections
+#define PIN_BT_READY 5
 
 // This pin will be pulled HIGH when a client is connected over bluetooth.
 #define PIN_CONNECTED 4
@@ -37,14 +37,36 @@
 // reset your microcontoller at-will.
 #define UC_NRST 17
 
-#define MAX_SEND_WAIT 50
 #define MAX_CMD_BUFFER 128
-#define MAX_SEND_BUFFER 128
+
+// Size of the receive buffer for the microcontroller UART
+#define UC_RX_BUFFER 1024
+
+// Maximum length of one base64-encoded line received during `flash_esp32`
+#define OTA_BUFFER_SIZE 1024
+
+typedef ConfiguredBridge<BluetoothSerial, HardwareSerial> Bridge;
+
+// Points during startup at which `startupTimeline` records millis();
+// see the `stats` command.
+enum StartupEvent {
+    STARTUP_BEGIN,
+    STARTUP_UART_READY,
+    STARTUP_COMMANDS_READY,
+    STARTUP_FIRST_LOOP,
+    STARTUP_BT_READY,
+    STARTUP_EVENT_COUNT,
+};
 
 void setup();
 void loop();
-void sendBufferNow();
+void recordStartup(StartupEvent event);
 
 extern MultiSerial CmdSerial;
 extern HardwareSerial UCSerial;
 extern BluetoothSerial SerialBT;
+extern Bridge bridge;
+extern volatile unsigned long startupTimeline[STARTUP_EVENT_COUNT];
+// False until SerialBT.begin() has finished; SerialBT must not be used
+// before then.
+extern bool btReady;
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+
+// Runs a fixed list of actions separated by delays without blocking
+// loop(), so that commands like `reset_uc` can sequence pins while the
+// bridge keeps forwarding bytes.  Time is passed in by the caller
+// (normally `millis()`).
+
+struct SequenceStep {
+    void (*action)();
+    // Number of ms to wait after `action` before running the next step
+    unsigned long wait;
+};
+
+class Sequencer
+{
+    public:
+        // Runs the first step immediately (and any following steps that
+        // don't need a wait); the rest run from `poll`.  Returns false
+        // without doing anything if a sequence is already running.
+        bool start(const SequenceStep* sequence, uint8_t length, unsigned long now) {
+            if(busy()) {
+                return false;
+            }
+            steps = sequence;
+            stepCount = length;
+            nextStep = 0;
+            deadline = now;
+            poll(now);
+            return true;
+        }
+
+        // Runs any steps that are due; call on every pass through loop().
+        inline void poll(unsigned long now) {
+            while(nextStep < stepCount && (long)(now - deadline) >= 0) {
+                const SequenceStep& step = steps[nextStep++];
+                step.action();
+                deadline = now + step.wait;
+            }
+        }
+
+        bool busy() const {
+            return nextStep < stepCount;
+        }
+
+    private:
+        const SequenceStep* steps = 0;
+        uint8_t stepCount = 0;
+        uint8_t nextStep = 0;
+        unsigned long deadline = 0;
+};
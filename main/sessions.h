@@ -0,0 +1,43 @@
+#pragma once
+
+#include "SerialCommand.h"
+
+// Maximum number of bytes read from one interface's command session
+// before giving the next interface a turn.
+#define COMMAND_QUANTUM 32
+
+// Feeds each enabled session up to COMMAND_QUANTUM bytes from its own
+// interface, starting with a different session on each call so that a
+// busy interface can't starve the others.  `current` is set to each
+// session before it is given a byte, so that command handlers know
+// whom to reply to.  A session's reading stops as soon as it is no
+// longer enabled (e.g. bluetooth after `unescape`), leaving the rest
+// of its input to whatever reads the interface instead.
+inline void pollSessions(
+    SerialCommand* const* sessions,
+    uint8_t count,
+    uint8_t& next,
+    bool (*enabled)(SerialCommand*),
+    SerialCommand*& current
+) {
+    for(uint8_t i = 0; i < count; i++) {
+        SerialCommand* commands = sessions[(next + i) % count];
+        if(!enabled(commands)) {
+            continue;
+        }
+
+        Stream* serial = commands->getSerial();
+        for(uint8_t j = 0; j < COMMAND_QUANTUM && serial->available(); j++) {
+            int read = serial->read();
+            if(read == -1) {
+                break;
+            }
+            current = commands;
+            commands->readChar(read);
+            if(!enabled(commands)) {
+                break;
+            }
+        }
+    }
+    next = (next + 1) % count;
+}
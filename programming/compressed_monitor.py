@@ -0,0 +1,100 @@
+import argparse
+import sys
+import time
+
+import serial
+
+from lzstream import StreamDecoder
+from ota_flash import send_escape_sequence, type_escape_sequence
+
+
+def main(
+    port,
+    baud=115200,
+    escape_sequence=None,
+    escape_sequence_interbyte_delay=0,
+    stats_interval=0,
+):
+    decoder = StreamDecoder()
+    last_stats = time.time()
+
+    with serial.Serial(port, baud, timeout=0.1) as ser:
+        if escape_sequence:
+            send_escape_sequence(
+                ser, escape_sequence, escape_sequence_interbyte_delay
+            )
+        # Compression starts once we leave the command prompt; anything
+        # printed before then is passed through by the decoder as-is.
+        ser.write(b'compress 1\n')
+        ser.write(b'unescape\n')
+
+        try:
+            while True:
+                data = ser.read(ser.in_waiting or 1)
+                if data:
+                    sys.stdout.buffer.write(decoder.feed(data))
+                    sys.stdout.buffer.flush()
+
+                if stats_interval and time.time() > last_stats + stats_interval:
+                    print_stats(decoder)
+                    last_stats = time.time()
+        except KeyboardInterrupt:
+            pass
+
+    print_stats(decoder)
+
+
+def print_stats(decoder):
+    sys.stderr.write(
+        "<received {received} bytes for {decoded} bytes of output; "
+        "ratio {ratio:.3f}>\n".format(
+            received=decoder.received,
+            decoded=decoder.decoded,
+            ratio=decoder.ratio,
+        )
+    )
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(
+        description=(
+            'Display output from the bridged microcontroller, asking the '
+            'bridge to compress it before sending it over bluetooth.'
+        )
+    )
+    parser.add_argument('port', type=str)
+    parser.add_argument('--baud', type=int, default=115200)
+    parser.add_argument(
+        '--escape-sequence',
+        type=type_escape_sequence,
+        help=(
+            'Comma-separated bytes to transmit to escape the serial '
+            'pass-through to the microcontroller.  See `ota_flash.py '
+            '--help`.  Defaults to `0x04,0x04,0x04,!`.'
+        ),
+        default=[b'\4', b'\4', b'\4', b'!']
+    )
+    parser.add_argument(
+        '--escape-sequence-interbyte-delay',
+        type=float,
+        default=0.75,
+    )
+    parser.add_argument(
+        '--stats-interval',
+        type=float,
+        help=(
+            'Print the compression ratio to stderr every this many '
+            'seconds.  By default, it is printed only on exit.'
+        ),
+        default=0,
+    )
+
+    args = parser.parse_args()
+
+    main(
+        args.port,
+        baud=args.baud,
+        escape_sequence=args.escape_sequence,
+        escape_sequence_interbyte_delay=args.escape_sequence_interbyte_delay,
+        stats_interval=args.stats_interval,
+    )
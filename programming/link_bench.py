@@ -0,0 +1,649 @@
+import argparse
+import collections
+import json
+import random
+import re
+import time
+
+import serial
+
+from ota_flash import send_escape_sequence, type_escape_sequence
+
+
+READY_SIGNAL = b"<bench ready>"
+RESULT_PATTERN = re.compile(rb"<bench (\w+): ([^>]*)>")
+
+# Matches LINK_BENCH_IDLE_TIMEOUT in `main/linkbench.h`
+DEVICE_IDLE_TIMEOUT = 2.0
+
+# Matches LINK_BENCH_MAX_GAP in `main/linkbench.h`
+MAX_GAP = 1024
+
+# How long to wait for the device's report in source mode, allowing
+# for a link no slower than this many bytes per second.
+SOURCE_TIMEOUT = 10.0
+SOURCE_MIN_BYTES_PER_SECOND = 1000
+
+
+class BenchFailed(Exception):
+    pass
+
+
+def pattern(position):
+    # Matches `linkBenchPattern()` in `main/linkbench.h`
+    return (position + (position >> 8)) & 0xff
+
+
+def pattern_bytes(start, length):
+    return bytes(pattern(i) for i in range(start, start + length))
+
+
+class PatternChecker(object):
+    """Counts received bytes that don't match the pattern.
+
+    Mirrors `linkBenchSink()` in `main/linkbench.cpp`: a mismatching
+    byte that matches the pattern up to MAX_GAP positions further on,
+    and is followed by the byte after that, marks a gap of lost bytes
+    rather than an error, and the comparison carries on from there.
+    """
+
+    def __init__(self, count):
+        self.count = count
+        self.position = 0
+        self.errors = 0
+        # Position of the last byte if it followed a gap, until the
+        # next byte confirms it
+        self._gap_end = None
+
+    def feed(self, data):
+        for byte in data:
+            if self._gap_end is not None:
+                gap_end, self._gap_end = self._gap_end, None
+                if byte == pattern(gap_end + 1):
+                    self.position = gap_end + 2
+                    continue
+                self.errors += 1
+                self.position += 1
+
+            if byte == pattern(self.position):
+                self.position += 1
+                continue
+
+            gap_end = self._find_gap(byte)
+            if gap_end is None:
+                self.errors += 1
+                self.position += 1
+            elif gap_end + 1 < self.count:
+                self._gap_end = gap_end
+            else:
+                # Nothing more will come to confirm the last byte.
+                self.position = gap_end + 1
+
+    def finish(self):
+        if self._gap_end is not None:
+            self.position = self._gap_end + 1
+            self._gap_end = None
+        return self.errors
+
+    def _find_gap(self, byte):
+        last = min(self.position + MAX_GAP, self.count - 1)
+        for candidate in range(self.position + 1, last + 1):
+            if pattern(candidate) == byte:
+                return candidate
+        return None
+
+
+def percentile(values, pct):
+    ordered = sorted(values)
+    return ordered[(len(ordered) - 1) * pct // 100]
+
+
+class SimulatedBridge(object):
+    """Stands in for a serial port connected to the bridge.
+
+    Implements just enough of the firmware (escape sequence, command
+    echo and the `bench` command) over a link with the given one-way
+    latency (s), bandwidth (bytes/s) and probability of losing each
+    benchmark payload byte, so this script can be exercised without
+    hardware.
+    """
+
+    PROMPT = b"\r\n>> "
+    UC_BYTES_PER_SECOND = 230400 / 11  # 8E1
+
+    def __init__(
+        self,
+        escape_sequence,
+        latency=0.015,
+        bandwidth=20000,
+        loss=0.0,
+        seed=0,
+        timeout=1,
+    ):
+        self.timeout = timeout
+        self.latency = latency
+        self.bandwidth = bandwidth
+        self.loss = loss
+
+        self._escape_sequence = [
+            byte if isinstance(byte, int) else ord(byte)
+            for byte in escape_sequence
+        ]
+        self._escape_position = 0
+        self._escaped = False
+        self._line = bytearray()
+        self._random = random.Random(seed)
+
+        # Bytes on their way to the host, as (arrival time, byte)
+        self._outgoing = collections.deque()
+        self._uplink_free = 0
+        self._downlink_free = 0
+
+        self._mode = None
+        self._mode_bytes = 0
+        self._mode_expected = 0
+        self._mode_checker = None
+        self._mode_started = None
+        self._mode_last = 0
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def close(self):
+        pass
+
+    @property
+    def in_waiting(self):
+        now = time.monotonic()
+        self._expire(now)
+        return sum(1 for arrival, _ in self._outgoing if arrival <= now)
+
+    def write(self, data):
+        now = time.monotonic()
+        for byte in data:
+            self._uplink_free = (
+                max(self._uplink_free, now) + 1.0 / self.bandwidth
+            )
+            self._receive(byte, self._uplink_free + self.latency)
+        return len(data)
+
+    def read(self, size=1):
+        deadline = time.monotonic() + self.timeout
+        output = bytearray()
+
+        while len(output) < size:
+            now = time.monotonic()
+            self._expire(now)
+            while (
+                self._outgoing
+                and self._outgoing[0][0] <= now
+                and len(output) < size
+            ):
+                output.append(self._outgoing.popleft()[1])
+            if len(output) >= size or now >= deadline:
+                break
+
+            wake = deadline
+            if self._outgoing:
+                wake = min(wake, self._outgoing[0][0])
+            time.sleep(max(min(wake - now, 0.01), 0.0005))
+
+        return bytes(output)
+
+    def readline(self):
+        output = bytearray()
+        while True:
+            byte = self.read(1)
+            if not byte:
+                break
+            output += byte
+            if byte == b'\n':
+                break
+        return bytes(output)
+
+    def _send(self, data, at, lossy=False):
+        for byte in data:
+            if lossy and self._random.random() < self.loss:
+                continue
+            self._downlink_free = (
+                max(self._downlink_free, at) + 1.0 / self.bandwidth
+            )
+            self._outgoing.append((self._downlink_free + self.latency, byte))
+
+    def _send_result(self, mode, fields, at):
+        self._send(
+            "<bench {mode}: {fields}>\r\n".format(
+                mode=mode,
+                fields=" ".join(
+                    "{}={}".format(key, value) for key, value in fields
+                ),
+            ).encode('ascii'),
+            at,
+        )
+        self._send(self.PROMPT, at)
+
+    def _finish(self, at):
+        elapsed = 0
+        if self._mode_started is not None:
+            elapsed = self._mode_last - self._mode_started
+        received = self._mode_bytes
+        lost = 0
+        errors = 0
+        if self._mode == 'sink':
+            lost = self._mode_expected - received
+            errors = self._mode_checker.finish()
+
+        self._send_result(
+            self._mode,
+            [
+                ('bytes', received),
+                ('ms', int(elapsed * 1000)),
+                (
+                    'bytes_per_sec',
+                    int(received / elapsed) if elapsed else 0
+                ),
+                ('lost', lost),
+                ('errors', errors),
+            ],
+            at,
+        )
+        self._mode = None
+
+    def _expire(self, now):
+        if self._mode in ('sink', 'echo'):
+            timeout_at = self._mode_last + DEVICE_IDLE_TIMEOUT
+            if now > timeout_at:
+                self._finish(timeout_at)
+
+    def _receive(self, byte, at):
+        self._expire(at)
+
+        if self._mode in ('sink', 'echo'):
+            if self._mode_started is None:
+                self._mode_started = at
+            self._mode_last = at
+            if self._mode == 'echo':
+                self._send([byte], at, lossy=True)
+            else:
+                self._mode_checker.feed([byte])
+            self._mode_bytes += 1
+            if self._mode == 'sink' and (
+                self._mode_bytes == self._mode_expected
+            ):
+                self._finish(at)
+        elif not self._escaped:
+            # Anything else is passed through to the microcontroller.
+            if byte == self._escape_sequence[self._escape_position]:
+                self._escape_position += 1
+            else:
+                self._escape_position = 0
+            if self._escape_position == len(self._escape_sequence):
+                self._escape_position = 0
+                self._escaped = True
+                self._send(b"<escape sequence received>\r\n", at)
+        elif byte == ord('\n'):
+            self._send(b'\n', at)
+            self._command(self._line.decode('ascii').split(), at)
+            self._line = bytearray()
+        elif 0x20 <= byte < 0x7f:
+            self._send([byte], at)
+            self._line.append(byte)
+
+    def _command(self, args, at):
+        if not args:
+            self._send(self.PROMPT, at)
+            return
+        if args[0] == 'unescape':
+            self._escaped = False
+            self._send(self.PROMPT, at)
+            return
+        if args[0] != 'bench':
+            self._send(
+                "<Unknown command: {}>\r\n".format(args[0]).encode('ascii'),
+                at,
+            )
+            self._send(self.PROMPT, at)
+            return
+
+        mode = args[1] if len(args) > 1 else None
+        count = int(args[2]) if len(args) > 2 else 65536
+
+        self._mode = mode
+        self._mode_bytes = 0
+        self._mode_expected = count
+        self._mode_checker = PatternChecker(count)
+        self._mode_started = None
+        self._mode_last = at
+
+        self._send(READY_SIGNAL + b"\r\n", at)
+        if mode == 'source':
+            self._send(pattern_bytes(0, count), at, lossy=True)
+            self._mode_started = at
+            self._mode_last = self._downlink_free
+            self._mode_bytes = count
+            self._finish(self._downlink_free)
+        elif mode == 'loop':
+            # The UART jumper isn't simulated beyond its line rate
+            rtt = 32 / self.UC_BYTES_PER_SECOND
+            elapsed = count / self.UC_BYTES_PER_SECOND
+            self._send_result(
+                'loop',
+                [
+                    ('bytes', count),
+                    ('ms', int(elapsed * 1000)),
+                    ('bytes_per_sec', int(self.UC_BYTES_PER_SECOND)),
+                    ('lost', 0),
+                    ('errors', 0),
+                    ('rtt_p50_us', int(rtt * 1e6)),
+                    ('rtt_p90_us', int(rtt * 1e6)),
+                    ('rtt_p99_us', int(rtt * 1e6)),
+                    ('rtt_max_us', int(rtt * 1e6)),
+                ],
+                at,
+            )
+            self._mode = None
+        elif mode not in ('sink', 'echo'):
+            self._mode = None
+
+
+def parse_result(line):
+    match = RESULT_PATTERN.search(line)
+    if not match:
+        return None
+    result = {'mode': match.group(1).decode('ascii')}
+    for field in match.group(2).decode('ascii').split():
+        key, value = field.split('=', 1)
+        result[key] = int(value)
+    return result
+
+
+def wait_for_line(ser, prefix, timeout):
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        line = ser.readline()
+        if prefix in line:
+            return line
+    raise BenchFailed(
+        "Timed out waiting for {}".format(prefix.decode('ascii'))
+    )
+
+
+def start_bench(ser, mode, count=None):
+    command = 'bench {}'.format(mode)
+    if count is not None:
+        command += ' {}'.format(count)
+    ser.write(command.encode('ascii') + b'\n')
+    wait_for_line(ser, READY_SIGNAL, timeout=5)
+
+
+def bench_source(ser, count):
+    marker = b"<bench source:"
+    start_bench(ser, 'source', count)
+
+    # Bytes lost along the way mean the device's report can arrive
+    # before `count` bytes have, so read until it does.
+    received = bytearray()
+    started = time.monotonic()
+    deadline = (
+        started + SOURCE_TIMEOUT + count / SOURCE_MIN_BYTES_PER_SECOND
+    )
+    while marker not in received and time.monotonic() < deadline:
+        received += ser.read(min(max(ser.in_waiting, 1), 4096))
+    finished = time.monotonic()
+
+    if marker not in received:
+        raise BenchFailed("Timed out waiting for <bench source:")
+    index = received.index(marker)
+    received, tail = received[:index], received[index:]
+    if b"\n" not in tail:
+        tail += wait_for_line(ser, b">", timeout=5)
+    device = parse_result(bytes(tail))
+
+    checker = PatternChecker(count)
+    checker.feed(received)
+    errors = checker.finish()
+    elapsed = finished - started
+    return {
+        'mode': 'source',
+        'bytes': len(received),
+        'lost': count - len(received),
+        'errors': errors,
+        'bytes_per_sec': int(len(received) / elapsed) if elapsed else 0,
+        'device': device,
+    }
+
+
+def bench_sink(ser, count, chunk_size):
+    start_bench(ser, 'sink', count)
+
+    started = time.monotonic()
+    for position in range(0, count, chunk_size):
+        ser.write(pattern_bytes(position, min(chunk_size, count - position)))
+    device = parse_result(
+        wait_for_line(
+            ser, b"<bench sink:", timeout=DEVICE_IDLE_TIMEOUT + 30
+        )
+    )
+    elapsed = time.monotonic() - started
+
+    return {
+        'mode': 'sink',
+        'bytes': device['bytes'],
+        'lost': device['lost'],
+        'errors': device['errors'],
+        'bytes_per_sec': device['bytes_per_sec'] or int(
+            device['bytes'] / elapsed
+        ),
+        'device': device,
+    }
+
+
+def bench_echo(ser, packets, packet_size, timeout):
+    start_bench(ser, 'echo')
+
+    ser.timeout = timeout
+    rtts = []
+    lost = 0
+    errors = 0
+    started = time.monotonic()
+    for packet in range(packets):
+        payload = pattern_bytes(packet * packet_size, packet_size)
+        sent = time.monotonic()
+        ser.write(payload)
+
+        # Must stay well below the device's idle timeout, or a lost
+        # byte would end the benchmark early.
+        response = ser.read(packet_size)
+        if len(response) == packet_size:
+            rtts.append(time.monotonic() - sent)
+        lost += packet_size - len(response)
+        errors += sum(1 for a, b in zip(payload, response) if a != b)
+    elapsed = time.monotonic() - started
+
+    device = parse_result(
+        wait_for_line(ser, b"<bench echo:", timeout=DEVICE_IDLE_TIMEOUT + 5)
+    )
+
+    result = {
+        'mode': 'echo',
+        'bytes': packets * packet_size - lost,
+        'lost': lost,
+        'errors': errors,
+        'bytes_per_sec': int((packets * packet_size - lost) / elapsed),
+        'device': device,
+    }
+    if rtts:
+        for pct in (50, 90, 99):
+            result['rtt_p{}_us'.format(pct)] = int(
+                percentile(rtts, pct) * 1e6
+            )
+        result['rtt_max_us'] = int(max(rtts) * 1e6)
+    return result
+
+
+def bench_loop(ser, count):
+    start_bench(ser, 'loop', count)
+
+    device = parse_result(wait_for_line(ser, b"<bench loop:", timeout=60))
+    result = dict(device)
+    result['device'] = device
+    return result
+
+
+def print_report(result):
+    print("{}:".format(result['mode']))
+    for key in (
+        'bytes', 'lost', 'errors', 'bytes_per_sec',
+        'rtt_p50_us', 'rtt_p90_us', 'rtt_p99_us', 'rtt_max_us', 'aborted',
+    ):
+        if key in result:
+            print("  {:<16}{}".format(key, result[key]))
+    if result.get('device'):
+        device = result['device']
+        print("  device: {}".format(", ".join(
+            "{}={}".format(key, value)
+            for key, value in device.items() if key != 'mode'
+        )))
+
+
+def main(
+    port,
+    modes,
+    baud=115200,
+    count=65536,
+    packets=200,
+    packet_size=32,
+    chunk_size=512,
+    escape_sequence=None,
+    escape_sequence_interbyte_delay=0,
+    simulate=False,
+    sim_latency=0.015,
+    sim_bandwidth=20000,
+    sim_loss=0.0,
+    as_json=False,
+):
+    if simulate:
+        connection = SimulatedBridge(
+            escape_sequence or [],
+            latency=sim_latency,
+            bandwidth=sim_bandwidth,
+            loss=sim_loss,
+        )
+        escape_sequence_interbyte_delay = 0
+    else:
+        connection = serial.Serial(port, baud, timeout=1)
+
+    results = []
+    with connection as ser:
+        if escape_sequence:
+            send_escape_sequence(
+                ser, escape_sequence, escape_sequence_interbyte_delay
+            )
+
+        for mode in modes:
+            ser.timeout = 1
+            if mode == 'source':
+                result = bench_source(ser, count)
+            elif mode == 'sink':
+                result = bench_sink(ser, count, chunk_size)
+            elif mode == 'echo':
+                result = bench_echo(ser, packets, packet_size, timeout=0.5)
+            elif mode == 'loop':
+                result = bench_loop(ser, count)
+            results.append(result)
+            if not as_json:
+                print_report(result)
+
+    if as_json:
+        print(json.dumps(results, indent=2))
+    return results
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(
+        description=(
+            'Measure throughput, round-trip time and byte loss across '
+            'the bridge using its `bench` command.'
+        )
+    )
+    parser.add_argument('port', type=str, nargs='?')
+    parser.add_argument(
+        '--mode',
+        choices=['source', 'sink', 'echo', 'loop'],
+        action='append',
+        help=(
+            'Benchmark to run; may be given more than once.  `source` '
+            'measures ESP32->host throughput, `sink` host->ESP32 '
+            'throughput, `echo` round-trip time over bluetooth and '
+            '`loop` the microcontroller UART (requires UC_TX to be '
+            'jumpered to UC_RX).  Defaults to source, sink and echo.'
+        ),
+    )
+    parser.add_argument('--baud', type=int, default=115200)
+    parser.add_argument(
+        '--bytes',
+        type=int,
+        help='Bytes to transfer in source, sink and loop modes.',
+        default=65536,
+    )
+    parser.add_argument(
+        '--packets',
+        type=int,
+        help='Number of packets to send in echo mode.',
+        default=200,
+    )
+    parser.add_argument('--packet-size', type=int, default=32)
+    parser.add_argument(
+        '--escape-sequence',
+        type=type_escape_sequence,
+        help=(
+            'Comma-separated bytes to transmit to escape the serial '
+            'pass-through to the microcontroller.  See `ota_flash.py '
+            '--help`.  Defaults to `0x04,0x04,0x04,!`.'
+        ),
+        default=[b'\4', b'\4', b'\4', b'!']
+    )
+    parser.add_argument(
+        '--escape-sequence-interbyte-delay',
+        type=float,
+        default=0.75,
+    )
+    parser.add_argument(
+        '--simulate',
+        action='store_true',
+        help=(
+            'Run against a simulated bridge instead of a serial port; '
+            'see the --sim-* options for the simulated link.'
+        ),
+    )
+    parser.add_argument('--sim-latency', type=float, default=0.015)
+    parser.add_argument('--sim-bandwidth', type=int, default=20000)
+    parser.add_argument('--sim-loss', type=float, default=0.0)
+    parser.add_argument(
+        '--json',
+        action='store_true',
+        help='Print results as JSON.',
+    )
+
+    args = parser.parse_args()
+    if not args.simulate and not args.port:
+        parser.error('a port is required unless --simulate is given')
+
+    main(
+        args.port,
+        args.mode or ['source', 'sink', 'echo'],
+        baud=args.baud,
+        count=args.bytes,
+        packets=args.packets,
+        packet_size=args.packet_size,
+        escape_sequence=args.escape_sequence,
+        escape_sequence_interbyte_delay=args.escape_sequence_interbyte_delay,
+        simulate=args.simulate,
+        sim_latency=args.sim_latency,
+        sim_bandwidth=args.sim_bandwidth,
+        sim_loss=args.sim_loss,
+        as_json=args.json,
+    )
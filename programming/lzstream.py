@@ -0,0 +1,119 @@
+"""Decoder for the bridge's compressed stream; see `main/lzstream.h`."""
+
+# These must match `main/lzstream.h`
+STREAM_START = b"<compression on>\r\n"
+FRAME_RAW = 0x00
+FRAME_COMPRESSED = 0x01
+FRAME_END = 0x02
+
+WINDOW_SIZE = 1024
+MIN_MATCH = 3
+
+
+class DecodeError(Exception):
+    pass
+
+
+class StreamDecoder(object):
+    """Turns bytes received from the bridge back into the bytes sent by
+    the microcontroller.
+
+    Bytes are passed through untouched until the bridge announces
+    compression with `STREAM_START`; from then on they are decoded as
+    frames until `FRAME_END` is received.
+    """
+
+    def __init__(self):
+        self.compressed = False
+        # Bytes received while compressed, and bytes they decoded to
+        self.received = 0
+        self.decoded = 0
+
+        self._buffer = bytearray()
+        self._window = bytearray()
+
+    @property
+    def ratio(self):
+        if not self.decoded:
+            return 1.0
+        return self.received / self.decoded
+
+    def feed(self, data):
+        self._buffer += data
+        output = bytearray()
+
+        while self._buffer:
+            if not self.compressed:
+                index = self._buffer.find(STREAM_START)
+                if index == -1:
+                    # Hold back anything that might be the start of
+                    # STREAM_START until we've seen the rest of it.
+                    keep = self._partial_start()
+                    output += self._buffer[:len(self._buffer) - keep]
+                    del self._buffer[:len(self._buffer) - keep]
+                    break
+
+                output += self._buffer[:index]
+                del self._buffer[:index + len(STREAM_START)]
+                self.compressed = True
+                self._window = bytearray()
+                continue
+
+            if len(self._buffer) < 2:
+                break
+            kind, length = self._buffer[0], self._buffer[1]
+            if len(self._buffer) < 2 + length:
+                break
+            payload = bytes(self._buffer[2:2 + length])
+            del self._buffer[:2 + length]
+
+            if kind == FRAME_END:
+                self.compressed = False
+                continue
+
+            start = len(self._window)
+            if kind == FRAME_RAW:
+                self._window += payload
+            elif kind == FRAME_COMPRESSED:
+                self._decompress(payload)
+            else:
+                raise DecodeError("Unknown frame kind {}".format(kind))
+            block = self._window[start:]
+            del self._window[:-WINDOW_SIZE]
+
+            self.received += 2 + length
+            self.decoded += len(block)
+            output += block
+
+        return bytes(output)
+
+    def _partial_start(self):
+        for length in range(len(STREAM_START) - 1, 0, -1):
+            if self._buffer.endswith(STREAM_START[:length]):
+                return length
+        return 0
+
+    def _decompress(self, payload):
+        window = self._window
+        position = 0
+
+        while position < len(payload):
+            flags = payload[position]
+            position += 1
+            for item in range(8):
+                if position >= len(payload):
+                    break
+                if not flags & (1 << item):
+                    window.append(payload[position])
+                    position += 1
+                    continue
+
+                if position + 1 >= len(payload):
+                    raise DecodeError("Truncated match")
+                low, high = payload[position], payload[position + 1]
+                position += 2
+                distance = (low | ((high >> 6) << 8)) + 1
+                if distance > len(window):
+                    raise DecodeError("Match before start of stream")
+                for _ in range((high & 0x3f) + MIN_MATCH):
+                    window.append(window[-distance])
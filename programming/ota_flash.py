@@ -38,10 +38,9 @@ def main(
                 ser.write(b'\n')
 
         if escape_sequence:
-            for byte in escape_sequence:
-                ser.write(byte)
-                time.sleep(escape_sequence_interbyte_delay)
-            ser.write(b'\n')
+            send_escape_sequence(
+                ser, escape_sequence, escape_sequence_interbyte_delay
+            )
 
         ser.write(b'flash_esp32\n')
 
@@ -62,6 +61,15 @@ def main(
                 break
 
 
+def send_escape_sequence(ser, escape_sequence, interbyte_delay):
+    for byte in escape_sequence:
+        if isinstance(byte, int):
+            byte = bytes([byte])
+        ser.write(byte)
+        time.sleep(interbyte_delay)
+    ser.write(b'\n')
+
+
 def transmit_file(ser, inf, chunk_size):
     output = bytearray()
 
@@ -146,7 +154,7 @@ if __name__ == '__main__':
         help=(
             'Comma-separated bytes to transmit to escape the serial '
             'pass-through to the microcontroller.  This should match '
-            '`BT_CTRL_ESCAPE_SEQUENCE` in `main.cpp`.  Non-printable '
+            '`BtCtrlEscapeSequence` in `bridgeconfig.h`.  Non-printable '
             'characters can be specified as hexadecimal values prefixed '
             'with `0x`.  Defaults to `0x04,0x04,0x04,!`.'
         ),